@@ -0,0 +1,191 @@
+// headless benchmark for catching performance regressions: build time, query latency percentiles,
+// queries per second and memory per entry, for each input distribution, size and MAX_DEPTH.
+// results are printed as a JSON array to stdout. bench_stats is built with ALH_LOOSE_QUADTREE_STATS
+// and adds the traversal counters per query (its timings include the counting)
+//
+// usage: bench [max_n = 1000000] [queries = 10000]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "rand.hpp"
+#include "loose_quadtree.hpp"
+
+using aabb_t = alh::loose_quadtree::aabb_t;
+using clock_type = std::chrono::steady_clock;
+
+// bytes currently held by trees using counting_allocator_t
+static size_t g_live_bytes = 0;
+
+template<typename U>
+struct counting_allocator_t {
+    using value_type = U;
+
+    counting_allocator_t() = default;
+    template<typename V> counting_allocator_t(counting_allocator_t<V> const&) {}
+
+    U *allocate(size_t n) {
+        g_live_bytes += n * sizeof(U);
+        return std::allocator<U>().allocate(n);
+    }
+
+    void deallocate(U *p, size_t n) {
+        g_live_bytes -= n * sizeof(U);
+        std::allocator<U>().deallocate(p, n);
+    }
+
+    template<typename V> bool operator==(counting_allocator_t<V> const&) const { return true; }
+};
+
+enum class dist_t { uniform, tri, normalish };
+
+static char const* dist_name(dist_t dist) {
+    switch (dist) {
+        case dist_t::uniform: return "uniform";
+        case dist_t::tri: return "tri";
+        case dist_t::normalish: return "normalish";
+    }
+    return "";
+}
+
+// the world grows with n so that the number of boxes per query stays about the same
+static float world_size(uint64_t n) { return 8.f * std::sqrt(float(n)); }
+
+static float sample(alh::rand_f32 &rng, dist_t dist, float min, float max) {
+    switch (dist) {
+        case dist_t::uniform: return rng.get_uniform(min, max);
+        case dist_t::tri: return rng.get_tri(min, max);
+        case dist_t::normalish: return rng.get_normalish(min, max);
+    }
+    return min;
+}
+
+static std::vector<aabb_t> make_boxes(alh::rand_f32 &rng, dist_t dist, uint64_t n) {
+    float world = world_size(n);
+    std::vector<aabb_t> boxes;
+    boxes.reserve(n);
+    for (uint64_t i=0; i<n; i++) {
+        aabb_t bb;
+        bb.min = {sample(rng, dist, 0.f, world), sample(rng, dist, 0.f, world)};
+        bb.max = {bb.min.x + rng.get_uniform(1.f, 8.f), bb.min.y + rng.get_uniform(1.f, 8.f)};
+        boxes.push_back(bb);
+    }
+    return boxes;
+}
+
+// queries follow the distribution of the data, so they mostly land where the boxes are
+static std::vector<aabb_t> make_queries(alh::rand_f32 &rng, dist_t dist, uint64_t n, uint32_t n_queries) {
+    float world = world_size(n);
+    std::vector<aabb_t> queries;
+    queries.reserve(n_queries);
+    for (uint32_t i=0; i<n_queries; i++) {
+        aabb_t bb;
+        bb.min = {sample(rng, dist, 0.f, world), sample(rng, dist, 0.f, world)};
+        bb.max = {bb.min.x + 32.f, bb.min.y + 32.f};
+        queries.push_back(bb);
+    }
+    return queries;
+}
+
+struct result_t {
+    double build_ms;
+    double p50_ns, p90_ns, p99_ns, max_ns;
+    double qps;
+    double hits_per_query;
+    double bytes_per_entry;
+#if defined(ALH_LOOSE_QUADTREE_STATS)
+    alh::loose_quadtree::query_stats_t stats;
+#endif
+};
+
+template<uint64_t MAX_DEPTH>
+static result_t run(std::vector<aabb_t> const& boxes, std::vector<aabb_t> const& queries) {
+    using tree_t = alh::loose_quadtree_t<void, MAX_DEPTH, 2, float, counting_allocator_t<std::byte>>;
+    result_t res{};
+
+    size_t bytes_before = g_live_bytes;
+    tree_t tree{counting_allocator_t<std::byte>()};
+
+    auto t0 = clock_type::now();
+    tree.build(boxes);
+    auto t1 = clock_type::now();
+    res.build_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    res.bytes_per_entry = double(g_live_bytes - bytes_before) / boxes.size();
+
+    std::vector<double> latencies;
+    latencies.reserve(queries.size());
+    uint64_t hits = 0;
+#if defined(ALH_LOOSE_QUADTREE_STATS)
+    tree.reset_query_stats();
+#endif
+    auto q0 = clock_type::now();
+    for (aabb_t const& q : queries) {
+        auto s = clock_type::now();
+        for (auto it = tree.query_start(q); it != tree.query_end(); ++it) hits++;
+        auto e = clock_type::now();
+        latencies.push_back(std::chrono::duration<double, std::nano>(e - s).count());
+    }
+    auto q1 = clock_type::now();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))]; };
+    res.p50_ns = percentile(0.50);
+    res.p90_ns = percentile(0.90);
+    res.p99_ns = percentile(0.99);
+    res.max_ns = latencies.back();
+    res.qps = queries.size() / std::chrono::duration<double>(q1 - q0).count();
+    res.hits_per_query = double(hits) / queries.size();
+#if defined(ALH_LOOSE_QUADTREE_STATS)
+    res.stats = tree.total_query_stats();
+#endif
+
+    return res;
+}
+
+static void print_result(bool &first, dist_t dist, uint64_t n, uint64_t max_depth, result_t const& r) {
+    std::printf("%s\n  {\"distribution\": \"%s\", \"n\": %llu, \"max_depth\": %llu, \"build_ms\": %.3f, "
+                "\"query_ns\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+                "\"qps\": %.0f, \"hits_per_query\": %.2f, \"bytes_per_entry\": %.2f",
+                first ? "" : ",", dist_name(dist), (unsigned long long)n, (unsigned long long)max_depth,
+                r.build_ms, r.p50_ns, r.p90_ns, r.p99_ns, r.max_ns, r.qps, r.hits_per_query, r.bytes_per_entry);
+#if defined(ALH_LOOSE_QUADTREE_STATS)
+    double q = double(r.stats.queries);
+    std::printf(", \"per_query\": {\"nodes_visited\": %.2f, \"nodes_culled\": %.2f, \"entries_tested\": %.2f}, "
+                "\"false_positive_ratio\": %.4f",
+                r.stats.nodes_visited / q, r.stats.nodes_culled / q, r.stats.entries_tested / q, r.stats.false_positive_ratio());
+#endif
+    std::printf("}");
+    first = false;
+}
+
+int main(int argc, char **argv) {
+    uint64_t max_n = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    uint32_t n_queries = (argc > 2) ? std::atoi(argv[2]) : 10000;
+
+    auto rng = alh::rand_f32();
+    rng.seed(1);
+
+    bool first = true;
+    std::printf("[");
+    for (dist_t dist : {dist_t::uniform, dist_t::tri, dist_t::normalish}) {
+        for (uint64_t n=1000; n<=max_n; n*=10) {
+            auto boxes = make_boxes(rng, dist, n);
+            auto queries = make_queries(rng, dist, n, n_queries);
+
+            print_result(first, dist, n, 4, run<4>(boxes, queries));
+            print_result(first, dist, n, 6, run<6>(boxes, queries));
+            print_result(first, dist, n, 8, run<8>(boxes, queries));
+            print_result(first, dist, n, 10, run<10>(boxes, queries));
+            std::fflush(stdout);
+        }
+    }
+    std::printf("\n]\n");
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+// compares building a fresh tree every frame with the default allocator against building
+// it into a per-frame std::pmr::monotonic_buffer_resource that is released after each frame
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <vector>
+
+#include "rand.hpp"
+#include "loose_quadtree.hpp"
+
+using aabb_t = alh::loose_quadtree::aabb_t;
+
+template<typename F>
+double time_ms(uint32_t frames, F &&frame) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t i=0; i<frames; i++) frame();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count() / frames;
+}
+
+int main(int argc, char **argv) {
+    uint32_t frames = (argc > 1) ? std::atoi(argv[1]) : 50;
+
+    auto rng = alh::rand_f32();
+    rng.seed(1);
+
+    for (uint32_t n : {1000u, 10000u, 100000u, 1000000u}) {
+        std::vector<aabb_t> rects;
+        std::vector<uint32_t> indices;
+        rects.reserve(n);
+        indices.reserve(n);
+        for (uint32_t i=0; i<n; i++) {
+            aabb_t bb;
+            bb.min = {rng.get_uniform(0.f, 4096.f), rng.get_uniform(0.f, 4096.f)};
+            bb.max = {bb.min.x + rng.get_uniform(1.f, 16.f), bb.min.y + rng.get_uniform(1.f, 16.f)};
+            rects.push_back(bb);
+            indices.push_back(i);
+        }
+
+        double ms_malloc = time_ms(frames, [&]{
+            alh::loose_quadtree_t<uint32_t, 8> qt(rects, indices);
+        });
+
+        // the arena is sized generously up front, so a frame never goes back to the upstream resource
+        std::vector<std::byte> arena(n * 256 + (1u << 20));
+        double ms_arena = time_ms(frames, [&]{
+            std::pmr::monotonic_buffer_resource frame_arena(arena.data(), arena.size(), std::pmr::null_memory_resource());
+            alh::pmr_loose_quadtree_t<uint32_t, 8> qt(rects, indices, {}, &frame_arena);
+        });
+
+        std::printf("n=%-8u malloc %9.3f ms/build   arena %9.3f ms/build   (%.2fx)\n",
+                    n, ms_malloc, ms_arena, ms_malloc / ms_arena);
+    }
+
+    return 0;
+}
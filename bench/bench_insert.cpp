@@ -0,0 +1,121 @@
+// throughput of concurrent insertion into loose_cell_quadtree_t: producers queue into their own
+// lanes of an insert_stage_t and the stage is applied at a sync point, for 1 to 32 threads.
+// the baseline is one thread calling insert() directly. results are printed as a JSON array,
+// each line a fresh tree receiving n boxes; the apply uses as many threads as there are producers
+//
+// usage: bench_insert [n = 1000000] [repeats = 3]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "rand.hpp"
+#include "loose_cell_quadtree.hpp"
+
+using tree_t = alh::loose_cell_quadtree_t<void, 8>;
+using aabb_t = tree_t::aabb_t;
+using clock_type = std::chrono::steady_clock;
+
+static double ms_since(clock_type::time_point t0) {
+    return std::chrono::duration<double, std::milli>(clock_type::now() - t0).count();
+}
+
+// the world grows with n so that the density stays about the same
+static aabb_t world_of(uint64_t n) {
+    float size = 8.f * std::sqrt(float(n));
+    return {{0.f, 0.f}, {size, size}};
+}
+
+static std::vector<aabb_t> make_boxes(alh::rand_f32 &rng, aabb_t const& world, uint64_t n) {
+    std::vector<aabb_t> boxes;
+    boxes.reserve(n);
+    for (uint64_t i=0; i<n; i++) {
+        aabb_t bb;
+        bb.min = {rng.get_uniform(world.min.x, world.max.x), rng.get_uniform(world.min.y, world.max.y)};
+        bb.max = {bb.min.x + rng.get_uniform(1.f, 8.f), bb.min.y + rng.get_uniform(1.f, 8.f)};
+        boxes.push_back(bb);
+    }
+    return boxes;
+}
+
+struct result_t {
+    double produce_ms; // until the last producer is done
+    double apply_ms;
+    double inserts_per_s;
+};
+
+static result_t run_direct(aabb_t const& world, std::vector<aabb_t> const& boxes) {
+    tree_t tree(world);
+    auto t0 = clock_type::now();
+    for (aabb_t const& bb : boxes) tree.insert(bb);
+    double ms = ms_since(t0);
+    return {ms, 0., boxes.size() / (ms / 1000.)};
+}
+
+static result_t run_staged(aabb_t const& world, std::vector<aabb_t> const& boxes, uint32_t threads) {
+    tree_t tree(world);
+    tree_t::insert_stage_t stage(tree, threads);
+
+    // producer t queues the t-th contiguous slice
+    auto t0 = clock_type::now();
+    std::vector<std::thread> producers;
+    for (uint32_t t=0; t<threads; t++) {
+        producers.emplace_back([&, t] {
+            size_t begin = boxes.size() * t / threads, end = boxes.size() * (t+1) / threads;
+            auto &lane = stage.lane(t);
+            for (size_t i=begin; i<end; i++) lane.insert(boxes[i]);
+        });
+    }
+    for (std::thread &p : producers) p.join();
+    double produce_ms = ms_since(t0);
+
+    auto t1 = clock_type::now();
+    tree.apply(stage, threads);
+    double apply_ms = ms_since(t1);
+
+    return {produce_ms, apply_ms, boxes.size() / ((produce_ms + apply_ms) / 1000.)};
+}
+
+static void print_result(bool &first, char const* mode, uint64_t n, uint32_t threads, result_t const& r) {
+    std::printf("%s\n  {\"mode\": \"%s\", \"n\": %llu, \"threads\": %u, \"produce_ms\": %.3f, \"apply_ms\": %.3f, "
+                "\"inserts_per_s\": %.0f}",
+                first ? "" : ",", mode, (unsigned long long)n, threads, r.produce_ms, r.apply_ms, r.inserts_per_s);
+    first = false;
+}
+
+// the repeat with the lowest total time
+template<typename F>
+static result_t best_of(uint32_t repeats, F &&run) {
+    result_t best = run();
+    for (uint32_t i=1; i<repeats; i++) {
+        result_t r = run();
+        if (r.produce_ms + r.apply_ms < best.produce_ms + best.apply_ms) best = r;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    uint64_t n = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    uint32_t repeats = (argc > 2) ? std::max(std::atoi(argv[2]), 1) : 3;
+
+    auto rng = alh::rand_f32();
+    rng.seed(1);
+    aabb_t world = world_of(n);
+    auto boxes = make_boxes(rng, world, n);
+
+    bool first = true;
+    std::printf("[");
+    print_result(first, "direct", n, 1, best_of(repeats, [&] { return run_direct(world, boxes); }));
+    for (uint32_t threads : {1u, 2u, 4u, 8u, 16u, 32u}) {
+        print_result(first, "staged", n, threads, best_of(repeats, [&] { return run_staged(world, boxes, threads); }));
+        std::fflush(stdout);
+    }
+    std::printf("\n]\n");
+
+    return 0;
+}
@@ -0,0 +1,666 @@
+#ifndef ALH_LOOSE_CELL_QUADTREE_HPP
+#define ALH_LOOSE_CELL_QUADTREE_HPP
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <span>
+#include <thread>
+
+#include "loose_quadtree.hpp"
+
+namespace alh {
+
+// classic loose quadtree over a fixed world. level L splits the world into 2^L cells per axis and
+// each cell owns the box `looseness` times its size around the same center. an entry lives in
+// the cell of its center at the deepest level whose loose box still holds it, both follow from
+// its center and size in O(1), so insert, move and remove never descend a tree. queries scan the
+// cells overlapping the query grown by the loose margin, level by level. cells are dense arrays
+// (2^(D*L) heads at level L) in Morton order, so keep MAX_DEPTH moderate. entries centered
+// outside the world go to the border cells and are still found. floating-point coordinates only.
+// with a margin, entries are placed by a fat box around the real one and moves that stay inside
+// it only store the new box
+template<typename T=void*, uint64_t MAX_DEPTH=8, uint32_t D=2, typename S=float, typename Alloc=std::allocator<std::byte>>
+struct loose_cell_quadtree_t {
+    static_assert(std::is_floating_point_v<S>, "cells are located with floating-point arithmetic");
+    static_assert(MAX_DEPTH * D < 64, "cell codes are 64 bits");
+
+    using id_t = uint64_t;
+    using allocator_type = Alloc;
+    using scalar_t = S;
+    using scalar_traits_t = typename loose_quadtree::scalar_traits_t<S>;
+    using point_t = typename loose_quadtree::basic_point_t<D, S>;
+    using aabb_t = typename loose_quadtree::basic_aabb_t<D, S>;
+
+    // what queries yield, T = void yields the id returned by insert
+    using payload_t = std::conditional_t<std::is_void_v<T>, id_t, T>;
+
+    static constexpr id_t empty = id_t(-1);
+    static constexpr uint32_t n_children = 1u << D;
+    static constexpr uint32_t n_levels = MAX_DEPTH + 1;
+
+    // stands in for the payload when T = void
+    struct no_payload_t {};
+
+    template<typename U, typename A=Alloc>
+    using vector_t = std::vector<U, typename std::allocator_traits<A>::template rebind_alloc<U>>;
+
+    struct options_t {
+        S looseness = S(2);       // > 1, 2 is the classic choice (cells twice their nominal size)
+        S margin = S(0);          // fat boxes grow the real box by this on every side...
+        S velocity_margin = S(0); // ...plus this times how far the box moved along each axis
+    };
+
+    // counters of move() since construction or the last reset
+    struct update_stats_t {
+        uint64_t moves = 0;
+        uint64_t skipped = 0;  // the box stayed inside its fat box
+        uint64_t relinked = 0; // the fat box moved to another cell
+    };
+
+    explicit loose_cell_quadtree_t(aabb_t const& world, options_t const& opts = {}, allocator_type const& alloc = {})
+        : world(world), opts(opts), entries(alloc), heads(level_offset(n_levels), empty, alloc) {
+        S looseness = opts.looseness;
+        assert(looseness > S(1));
+        assert(opts.margin >= S(0) && opts.velocity_margin >= S(0));
+
+        for (uint32_t l=0; l<n_levels; l++) {
+            for (uint32_t d=0; d<D; d++) {
+                S extent = world.max[d] - world.min[d];
+                assert(extent > S(0));
+                S n_cells = S(uint64_t(1) << l);
+                scale[l][d] = n_cells / extent;
+                margin[l][d] = (looseness - S(1)) / S(2) * (extent / n_cells);
+            }
+            level_count[l] = 0;
+        }
+    }
+
+    allocator_type get_allocator() const { return allocator_type(entries.get_allocator()); }
+
+    // ids stay valid until the entry is removed, then they are reused
+    template<typename U> requires std::same_as<std::decay_t<U>, T>
+    id_t insert(aabb_t const& bb, U &&data) {
+        id_t id = allocate();
+        entries[id].data = std::forward<U>(data);
+        place(id, bb);
+        return id;
+    }
+
+    id_t insert(aabb_t const& bb) requires std::is_void_v<T> {
+        id_t id = allocate();
+        place(id, bb);
+        return id;
+    }
+
+    // a no-op apart from storing bb while it stays inside the fat box, otherwise the fat box is
+    // grown again around bb and the entry relinked if that changed its cell
+    void move(id_t id, aabb_t const& bb) {
+        assert(is_live(id));
+        id_t cell = refit(entries[id], bb, stats);
+        if (empty == cell) return;
+
+        unlink(id, level_count);
+        link(id, cell, level_count);
+    }
+
+    void remove(id_t id) {
+        assert(is_live(id));
+        unlink(id, level_count);
+        release(id);
+    }
+
+private:
+    // an entry changing cells in apply
+    struct relink_t {
+        id_t id;
+        id_t from; // empty for inserts
+        id_t to;   // empty for removes
+    };
+
+public:
+    // changes collected during a tick and applied together by apply(). each id may be moved or
+    // removed at most once per batch
+    struct update_batch_t {
+        template<typename U> requires std::same_as<std::decay_t<U>, T>
+        void insert(aabb_t const& bb, U &&data) { inserts.push_back({bb, std::forward<U>(data)}); }
+
+        void insert(aabb_t const& bb) requires std::is_void_v<T> { inserts.push_back({bb, {}}); }
+
+        void move(id_t id, aabb_t const& bb) { moves.push_back({id, bb}); }
+        void remove(id_t id) { removes.push_back(id); }
+
+        size_t size() const { return inserts.size() + moves.size() + removes.size(); }
+
+        void clear() {
+            inserts.clear();
+            moves.clear();
+            removes.clear();
+        }
+
+        // ids given to the inserts by the last apply, in the order they were queued
+        std::span<id_t const> inserted() const { return inserted_ids; }
+
+    private:
+        friend struct loose_cell_quadtree_t;
+
+        struct insert_t {
+            aabb_t bb;
+            [[no_unique_address]] std::conditional_t<std::is_void_v<T>, no_payload_t, T> data;
+        };
+
+        struct move_t {
+            id_t id;
+            aabb_t bb;
+        };
+
+        std::vector<insert_t> inserts;
+        std::vector<move_t> moves;
+        std::vector<id_t> removes;
+        std::vector<id_t> inserted_ids;
+
+        // scratch of apply, kept to reuse the capacity
+        std::vector<relink_t> relinks;
+        std::vector<std::vector<relink_t>> thread_relinks;
+    };
+
+    // applies and clears the batch. cells are resolved in parallel, then with threads > 1 the
+    // relinks are sorted by old cell for the unlinks and by new cell (level by level, Morton order
+    // within a level) for the links, each thread taking whole cells so no two threads touch the
+    // same list. on one thread the order does not matter and sorting did not pay for itself
+    void apply(update_batch_t &batch, uint32_t threads = 1) {
+        threads = std::max(threads, 1u);
+
+        // ids are taken before the parallel passes so that entries does not grow under them
+        batch.inserted_ids.clear();
+        for (auto &in : batch.inserts) {
+            id_t id = allocate();
+            if constexpr (!std::is_void_v<T>) entries[id].data = std::move(in.data);
+            batch.inserted_ids.push_back(id);
+        }
+
+#if !defined(NDEBUG)
+        {
+            std::vector<id_t> touched;
+            for (auto const& m : batch.moves) touched.push_back(m.id);
+            touched.insert(touched.end(), batch.removes.begin(), batch.removes.end());
+            std::sort(touched.begin(), touched.end());
+            assert(std::adjacent_find(touched.begin(), touched.end()) == touched.end() && "id moved or removed twice in a batch");
+            for (id_t id : touched) assert(is_live(id));
+        }
+#endif
+
+        // resolve the new cells, each item only writes its own entry. moves that stay in their
+        // cell are done here, the rest is collected per thread
+        size_t n_inserts = batch.inserts.size(), n_moves = batch.moves.size();
+        batch.thread_relinks.resize(threads);
+        std::vector<update_stats_t> thread_stats(threads);
+        parallel_chunks(n_inserts + n_moves + batch.removes.size(), threads, [](size_t, size_t) { return false; },
+                        [&](size_t begin, size_t end, uint32_t t) {
+            auto &out = batch.thread_relinks[t];
+            out.clear();
+            for (size_t i=begin; i<end; i++) {
+                if (i < n_inserts) {
+                    id_t id = batch.inserted_ids[i];
+                    entry_t &e = entries[id];
+                    e.aabb = batch.inserts[i].bb;
+                    e.fat = fatten(e.aabb, e.aabb);
+                    out.push_back({id, empty, cell_of(e.fat)});
+                } else if (i < n_inserts + n_moves) {
+                    auto const& m = batch.moves[i - n_inserts];
+                    id_t from = entries[m.id].cell;
+                    id_t to = refit(entries[m.id], m.bb, thread_stats[t]);
+                    if (empty != to) out.push_back({m.id, from, to});
+                } else {
+                    id_t id = batch.removes[i - n_inserts - n_moves];
+                    out.push_back({id, entries[id].cell, empty});
+                }
+            }
+        });
+
+        auto &relinks = batch.relinks;
+        relinks.clear();
+        for (auto &r : batch.thread_relinks) relinks.insert(relinks.end(), r.begin(), r.end());
+
+        std::vector<std::array<uint64_t, n_levels>> counts(threads);
+        for (auto &c : counts) c.fill(0);
+
+        auto by_from = [](relink_t const& a, relink_t const& b) { return a.from < b.from; };
+        size_t n_from = relinks.size();
+        if (threads > 1) {
+            std::sort(relinks.begin(), relinks.end(), by_from);
+            n_from = std::lower_bound(relinks.begin(), relinks.end(), relink_t{0, empty, 0}, by_from) - relinks.begin();
+        }
+        parallel_chunks(n_from, threads, [&](size_t a, size_t b) { return relinks[a].from == relinks[b].from; },
+                        [&](size_t begin, size_t end, uint32_t t) {
+            for (size_t i=begin; i<end; i++) {
+                if (empty != relinks[i].from) unlink(relinks[i].id, counts[t].data());
+            }
+        });
+
+        link_all(relinks, threads, counts);
+        for (auto const& st : thread_stats) {
+            stats.moves += st.moves;
+            stats.skipped += st.skipped;
+            stats.relinked += st.relinked;
+        }
+
+        for (id_t id : batch.removes) release(id);
+
+        batch.inserts.clear();
+        batch.moves.clear();
+        batch.removes.clear();
+    }
+
+    // inserts from many producer threads at once. every producer queues into its own lane (e.g. by
+    // the worker index of a job system), and the lane already works out the fat box and cell, so
+    // producers share nothing and never wait on each other. the queued entries are invisible until
+    // apply(stage) links them at a sync point, when no producer and no query is running
+    struct insert_stage_t {
+        struct alignas(64) lane_t {
+            template<typename U> requires std::same_as<std::decay_t<U>, T>
+            void insert(aabb_t const& bb, U &&data) {
+                aabb_t fat = tree->fatten(bb, bb);
+                items.push_back({bb, fat, tree->cell_of(fat), std::forward<U>(data)});
+            }
+
+            void insert(aabb_t const& bb) requires std::is_void_v<T> {
+                aabb_t fat = tree->fatten(bb, bb);
+                items.push_back({bb, fat, tree->cell_of(fat), {}});
+            }
+
+            size_t size() const { return items.size(); }
+
+            // ids given to this lane's inserts by the last apply, in the order they were queued
+            std::span<id_t const> inserted() const { return inserted_ids; }
+
+        private:
+            friend struct loose_cell_quadtree_t;
+            friend struct insert_stage_t;
+            explicit lane_t(loose_cell_quadtree_t const* tree) : tree(tree) {}
+
+            struct staged_t {
+                aabb_t bb;
+                aabb_t fat;
+                id_t cell;
+                [[no_unique_address]] std::conditional_t<std::is_void_v<T>, no_payload_t, T> data;
+            };
+
+            loose_cell_quadtree_t const* tree;
+            std::vector<staged_t> items;
+            std::vector<id_t> inserted_ids;
+        };
+
+        insert_stage_t(loose_cell_quadtree_t const& tree, uint32_t n_lanes) {
+            lanes.reserve(n_lanes);
+            for (uint32_t i=0; i<n_lanes; i++) lanes.push_back(lane_t(&tree));
+        }
+
+        lane_t &lane(uint32_t i) { assert(i < lanes.size()); return lanes[i]; }
+        lane_t const& lane(uint32_t i) const { assert(i < lanes.size()); return lanes[i]; }
+        uint32_t n_lanes() const { return uint32_t(lanes.size()); }
+
+    private:
+        friend struct loose_cell_quadtree_t;
+
+        std::vector<lane_t> lanes;
+
+        // scratch of apply, kept to reuse the capacity
+        std::vector<size_t> offsets;
+        std::vector<relink_t> relinks;
+    };
+
+    // links everything queued in the stage (made for this tree) and clears its lanes. the ids
+    // are handed out in lane order first, then entries are filled and linked in parallel
+    void apply(insert_stage_t &stage, uint32_t threads = 1) {
+        threads = std::max(threads, 1u);
+
+        auto &offsets = stage.offsets;
+        offsets.assign(1, 0);
+        size_t n_new = 0;
+        for (auto const& lane : stage.lanes) n_new += lane.items.size();
+        entries.reserve(entries.size() + n_new);
+        for (auto &lane : stage.lanes) {
+            assert(this == lane.tree);
+            lane.inserted_ids.clear();
+            for (size_t j=0; j<lane.items.size(); j++) lane.inserted_ids.push_back(allocate());
+            offsets.push_back(offsets.back() + lane.items.size());
+        }
+
+        auto &relinks = stage.relinks;
+        relinks.resize(offsets.back());
+        parallel_chunks(relinks.size(), threads, [](size_t, size_t) { return false; },
+                        [&](size_t begin, size_t end, uint32_t) {
+            size_t l = std::upper_bound(offsets.begin(), offsets.end(), begin) - offsets.begin() - 1;
+            for (size_t i=begin; i<end; i++) {
+                while (i >= offsets[l+1]) l++;
+                auto &lane = stage.lanes[l];
+                auto &item = lane.items[i - offsets[l]];
+                id_t id = lane.inserted_ids[i - offsets[l]];
+
+                entry_t &e = entries[id];
+                e.aabb = item.bb;
+                e.fat = item.fat;
+                if constexpr (!std::is_void_v<T>) e.data = std::move(item.data);
+                relinks[i] = {id, empty, item.cell};
+            }
+        });
+
+        std::vector<std::array<uint64_t, n_levels>> counts(threads);
+        for (auto &c : counts) c.fill(0);
+        link_all(relinks, threads, counts);
+
+        for (auto &lane : stage.lanes) lane.items.clear();
+    }
+
+    void clear() {
+        entries.clear();
+        std::fill(heads.begin(), heads.end(), empty);
+        std::fill(std::begin(level_count), std::end(level_count), uint64_t(0));
+        free_head = empty;
+        n_live = 0;
+    }
+
+    size_t size() const { return n_live; }
+
+    update_stats_t const& update_stats() const { return stats; }
+    void reset_update_stats() { stats = update_stats_t{}; }
+
+    aabb_t const& bounds(id_t id) const { assert(is_live(id)); return entries[id].aabb; }
+
+    template<typename U=T> requires (!std::is_void_v<U>)
+    U &data(id_t id) { assert(is_live(id)); return entries[id].data; }
+
+    template<typename U=T> requires (!std::is_void_v<U>)
+    U const& data(id_t id) const { assert(is_live(id)); return entries[id].data; }
+
+    // calls fn(payload) for every entry intersecting query_bb
+    template<typename F>
+    void query(aabb_t const& query_bb, F &&fn) const {
+        for (uint32_t l=0; l<n_levels; l++) {
+            if (0 == level_count[l]) continue;
+
+            // the grown query reaches every cell whose loose box it overlaps, computed with the
+            // same expressions as the fit test in level_of so that rounding cannot lose entries
+            uint64_t lo[D], hi[D];
+            for (uint32_t d=0; d<D; d++) {
+                lo[d] = coord(query_bb.min[d] - margin[l][d], l, d);
+                hi[d] = coord(query_bb.max[d] + margin[l][d], l, d);
+            }
+            query_level(query_bb, l, lo, hi, fn);
+        }
+    }
+
+private:
+    struct entry_t {
+        aabb_t aabb;
+        aabb_t fat; // placed by this one, holds aabb
+        id_t cell = empty; // index into heads, empty while the slot is free
+        id_t prev = empty;
+        id_t next = empty; // also links the free slots
+        [[no_unique_address]] std::conditional_t<std::is_void_v<T>, no_payload_t, T> data;
+    };
+
+    // cells of all levels before level l, level l has 2^(D*l) of them
+    static constexpr uint64_t level_offset(uint32_t l) {
+        return ((uint64_t(1) << (D * l)) - 1) / ((uint64_t(1) << D) - 1);
+    }
+
+    // bits d, d+D, d+2D... the positions of axis d in a Morton code
+    static constexpr auto axis_masks = [] {
+        std::array<uint64_t, D> masks{};
+        for (uint32_t d=0; d<D; d++) {
+            for (uint32_t b=0; b*D+d < 64; b++) masks[d] |= uint64_t(1) << (b*D + d);
+        }
+        return masks;
+    }();
+
+    static uint64_t spread(uint64_t x, uint32_t d) {
+        uint64_t code = 0;
+        for (uint32_t b=0; b<MAX_DEPTH; b++) code |= ((x >> b) & 1) << (b*D + d);
+        return code;
+    }
+
+    bool is_live(id_t id) const { return id < entries.size() && empty != entries[id].cell; }
+
+    // cell coordinate of x along axis d at level l, clamped to the world (NaN goes to 0)
+    uint64_t coord(S x, uint32_t l, uint32_t d) const {
+        S f = (x - world.min[d]) * scale[l][d];
+        uint64_t n_cells = uint64_t(1) << l;
+        if (!(f >= S(0))) return 0;
+        if (f >= S(n_cells)) return n_cells - 1;
+        return uint64_t(f);
+    }
+
+    bool fits(aabb_t const& bb, point_t const& center, uint32_t l) const {
+        for (uint32_t d=0; d<D; d++) {
+            if (!(bb.min[d] + margin[l][d] >= center[d] && bb.max[d] - margin[l][d] <= center[d])) return false;
+        }
+        return true;
+    }
+
+    // deepest level whose loose cells hold bb, estimated from its size and corrected for rounding
+    uint32_t level_of(aabb_t const& bb, point_t const& center) const {
+        int level = int(MAX_DEPTH);
+        for (uint32_t d=0; d<D; d++) {
+            S half = std::max(center[d] - bb.min[d], bb.max[d] - center[d]);
+            if (half > S(0)) level = std::min(level, std::ilogb(margin[0][d] / half));
+        }
+        uint32_t l = uint32_t(std::clamp(level, 0, int(MAX_DEPTH)));
+        while (l > 0 && !fits(bb, center, l)) l--; // level 0 has a single cell and holds anything
+        return l;
+    }
+
+    id_t cell_of(aabb_t const& bb) const {
+        point_t center;
+        for (uint32_t d=0; d<D; d++) center[d] = scalar_traits_t::mid(bb.min[d], bb.max[d]);
+
+        uint32_t l = level_of(bb, center);
+        uint64_t code = 0;
+        for (uint32_t d=0; d<D; d++) code |= spread(coord(center[d], l, d), d);
+        return level_offset(l) + code;
+    }
+
+    static uint32_t level_of_cell(id_t cell) {
+        uint32_t l = 0;
+        while (l+1 < n_levels && cell >= level_offset(l+1)) l++;
+        return l;
+    }
+
+    id_t allocate() {
+        id_t id;
+        if (empty != free_head) {
+            id = free_head;
+            free_head = entries[id].next;
+        } else {
+            id = entries.size();
+            entries.emplace_back();
+        }
+        n_live++;
+        return id;
+    }
+
+    void place(id_t id, aabb_t const& bb) {
+        entries[id].aabb = bb;
+        entries[id].fat = fatten(bb, bb);
+        link(id, cell_of(entries[id].fat), level_count);
+    }
+
+    // frees the slot of an unlinked entry
+    void release(id_t id) {
+        if constexpr (!std::is_void_v<T>) entries[id].data = T();
+        entries[id].cell = empty;
+        entries[id].next = free_head;
+        free_head = id;
+        n_live--;
+    }
+
+    // stores bb and returns the cell the entry has to move to, empty if it stays where it is
+    id_t refit(entry_t &e, aabb_t const& bb, update_stats_t &st) const {
+        st.moves++;
+        if (contains(e.fat, bb)) {
+            e.aabb = bb;
+            st.skipped++;
+            return empty;
+        }
+
+        e.fat = fatten(bb, e.aabb);
+        e.aabb = bb;
+        id_t cell = cell_of(e.fat);
+        if (cell == e.cell) return empty;
+
+        st.relinked++;
+        return cell;
+    }
+
+    static bool contains(aabb_t const& outer, aabb_t const& inner) {
+        for (uint32_t d=0; d<D; d++) {
+            if (!(outer.min[d] <= inner.min[d] && inner.max[d] <= outer.max[d])) return false;
+        }
+        return true;
+    }
+
+    // bb grown by the margin, plus the velocity margin scaled by the distance from the last box
+    aabb_t fatten(aabb_t const& bb, aabb_t const& last) const {
+        aabb_t fat = bb;
+        for (uint32_t d=0; d<D; d++) {
+            S moved = std::abs(scalar_traits_t::mid(bb.min[d], bb.max[d]) - scalar_traits_t::mid(last.min[d], last.max[d]));
+            S grow = opts.margin + opts.velocity_margin * moved;
+            fat.min[d] -= grow;
+            fat.max[d] += grow;
+        }
+        return fat;
+    }
+
+    // link and unlink only touch the list of one cell, counts is level_count or a per-thread copy
+    void link(id_t id, id_t cell, uint64_t *counts) {
+        entry_t &e = entries[id];
+        e.cell = cell;
+        e.prev = empty;
+        e.next = heads[cell];
+        if (empty != e.next) entries[e.next].prev = id;
+        heads[cell] = id;
+        counts[level_of_cell(cell)]++;
+    }
+
+    void unlink(id_t id, uint64_t *counts) {
+        entry_t &e = entries[id];
+        if (empty != e.prev) entries[e.prev].next = e.next;
+        else heads[e.cell] = e.next;
+        if (empty != e.next) entries[e.next].prev = e.prev;
+        counts[level_of_cell(e.cell)]--;
+    }
+
+    // links every relink that has a target cell and adds the per-thread counts to level_count.
+    // with threads > 1 they are sorted by cell first (level by level, Morton order within a
+    // level) and each thread takes whole cells, so no two threads touch the same list
+    void link_all(std::vector<relink_t> &relinks, uint32_t threads, std::vector<std::array<uint64_t, n_levels>> &counts) {
+        auto by_to = [](relink_t const& a, relink_t const& b) { return a.to < b.to; };
+        size_t n_to = relinks.size();
+        if (threads > 1) {
+            std::sort(relinks.begin(), relinks.end(), by_to);
+            n_to = std::lower_bound(relinks.begin(), relinks.end(), relink_t{0, 0, empty}, by_to) - relinks.begin();
+        }
+        parallel_chunks(n_to, threads, [&](size_t a, size_t b) { return relinks[a].to == relinks[b].to; },
+                        [&](size_t begin, size_t end, uint32_t t) {
+            for (size_t i=begin; i<end; i++) {
+                if (empty != relinks[i].to) link(relinks[i].id, relinks[i].to, counts[t].data());
+            }
+        });
+
+        // wrapping sums, unlinks were counted as -1
+        for (auto const& c : counts) {
+            for (uint32_t l=0; l<n_levels; l++) level_count[l] += c[l];
+        }
+    }
+
+    // runs fn(begin, end, thread) over [0, n) in contiguous chunks on up to `threads` threads,
+    // never splitting i-1 and i apart where same(i-1, i). small inputs stay on the calling thread
+    template<typename Same, typename F>
+    static void parallel_chunks(size_t n, uint32_t threads, Same &&same, F &&fn) {
+        static constexpr size_t min_chunk = 4096;
+        threads = uint32_t(std::clamp<size_t>(n / min_chunk, 1, std::max(threads, 1u)));
+        if (1 == threads) {
+            if (n > 0) fn(size_t(0), n, 0u);
+            return;
+        }
+
+        std::vector<size_t> bounds(threads + 1, n);
+        bounds[0] = 0;
+        for (uint32_t t=1; t<threads; t++) {
+            size_t b = std::max(bounds[t-1], n * t / threads);
+            while (b > 0 && b < n && same(b-1, b)) b++;
+            bounds[t] = b;
+        }
+
+        std::vector<std::thread> workers;
+        for (uint32_t t=1; t<threads; t++) {
+            if (bounds[t] < bounds[t+1]) workers.emplace_back(fn, bounds[t], bounds[t+1], t);
+        }
+        if (bounds[0] < bounds[1]) fn(bounds[0], bounds[1], 0u);
+        for (std::thread &w : workers) w.join();
+    }
+
+    // visits the cells in [lo, hi] along every axis, stepping the Morton code of each axis
+    // in place ((code | ~mask) + 1 carries through the bits of the other axes)
+    template<typename F>
+    void query_level(aabb_t const& query_bb, uint32_t l, uint64_t const (&lo)[D], uint64_t const (&hi)[D], F &fn) const {
+        uint64_t coords[D], codes[D], codes_lo[D];
+        for (uint32_t d=0; d<D; d++) {
+            coords[d] = lo[d];
+            codes[d] = codes_lo[d] = spread(lo[d], d);
+        }
+
+        id_t const* level_heads = heads.data() + level_offset(l);
+        for (;;) {
+            uint64_t code = 0;
+            for (uint32_t d=0; d<D; d++) code |= codes[d];
+
+            for (id_t i = level_heads[code]; empty != i; i = entries[i].next) {
+                if (query_bb.intersect(entries[i].aabb)) {
+                    if constexpr (std::is_void_v<T>) fn(i);
+                    else fn(entries[i].data);
+                }
+            }
+
+            uint32_t d = 0;
+            for (; d<D; d++) {
+                if (coords[d] < hi[d]) {
+                    coords[d]++;
+                    codes[d] = ((codes[d] | ~axis_masks[d]) + 1) & axis_masks[d];
+                    break;
+                }
+                coords[d] = lo[d];
+                codes[d] = codes_lo[d];
+            }
+            if (D == d) break;
+        }
+    }
+
+    aabb_t world;
+    options_t opts;
+    update_stats_t stats;
+    S scale[n_levels][D];  // cells per unit along each axis
+    S margin[n_levels][D]; // how far the loose box reaches past the cell on each side
+
+    vector_t<entry_t> entries;
+    vector_t<id_t> heads;
+    uint64_t level_count[n_levels];
+    id_t free_head = empty;
+    size_t n_live = 0;
+};
+
+template<typename T=void*, uint64_t MAX_DEPTH=6, typename S=float>
+using loose_cell_octree_t = loose_cell_quadtree_t<T, MAX_DEPTH, 3, S>;
+
+};
+
+#endif
@@ -3,89 +3,503 @@
 
 #include <cassert>
 #include <cstdint>
+#include <ostream>
 #include <vector>
+#include <memory>
+#include <memory_resource>
 #include <limits>
 #include <algorithm>
+#include <thread>
+#include <span>
+#include <iterator>
+#include <utility>
+#include <type_traits>
+#include <concepts>
 
 namespace alh {
 
+template<typename T, uint64_t MAX_DEPTH, uint32_t D, typename S>
+struct loose_quadtree_external_builder_t;
+
 namespace loose_quadtree {
-    struct point_t {
-        float x, y;
+    // lowest/highest are the sentinels of an empty box, mid is the split point of [a, b].
+    // specialize for custom (e.g. fixed-point) coordinate types
+    template<typename S>
+    struct scalar_traits_t {
+        static constexpr S lowest() { return -std::numeric_limits<S>::infinity(); }
+        static constexpr S highest() { return std::numeric_limits<S>::infinity(); }
+        static constexpr S mid(S a, S b) { return (a + b) / S(2); }
+    };
+
+    // integer coordinates, the midpoint is floor((a + b) / 2) as shifts without overflowing
+    template<typename S> requires std::is_integral_v<S>
+    struct scalar_traits_t<S> {
+        static constexpr S lowest() { return std::numeric_limits<S>::lowest(); }
+        static constexpr S highest() { return std::numeric_limits<S>::max(); }
+        static constexpr S mid(S a, S b) { return (a & b) + ((a ^ b) >> 1); }
+    };
+
+    template<uint32_t D, typename S=float>
+    struct basic_point_t {
+        S v[D];
+
+        S &operator[](uint32_t i) { return v[i]; }
+        S const& operator[](uint32_t i) const { return v[i]; }
+    };
+
+    // named members for the common cases, operator[] is used by the dimension-generic code.
+    // the loops over d are unrolled, so the selects fold into plain member accesses
+    template<typename S>
+    struct basic_point_t<2, S> {
+        S x, y;
+
+        S &operator[](uint32_t i) { assert(i < 2); return 0 == i ? x : y; }
+        S const& operator[](uint32_t i) const { assert(i < 2); return 0 == i ? x : y; }
+    };
+
+    template<typename S>
+    struct basic_point_t<3, S> {
+        S x, y, z;
+
+        S &operator[](uint32_t i) { assert(i < 3); return 0 == i ? x : (1 == i ? y : z); }
+        S const& operator[](uint32_t i) const { assert(i < 3); return 0 == i ? x : (1 == i ? y : z); }
     };
 
-    struct aabb_t {
-        point_t min, max;
+    static_assert(sizeof(basic_point_t<2>) == 2 * sizeof(float));
+    static_assert(sizeof(basic_point_t<3>) == 3 * sizeof(float));
 
-        static bool intersect(aabb_t const& a, aabb_t const& b) { return a.intersect(b); }
-        
-        bool intersect(aabb_t const& other) const {
-            return (max.x >= other.min.x && min.x < other.max.x
-                && max.y >= other.min.y && min.y < other.max.y);
+    template<uint32_t D, typename S=float>
+    struct basic_aabb_t {
+        basic_point_t<D, S> min, max;
+
+        static bool intersect(basic_aabb_t const& a, basic_aabb_t const& b) { return a.intersect(b); }
+
+        bool intersect(basic_aabb_t const& other) const {
+            for (uint32_t d=0; d<D; d++) {
+                if (!(max[d] >= other.min[d] && min[d] < other.max[d])) return false;
+            }
+            return true;
+        }
+
+        void extend(basic_point_t<D, S> const& p) {
+            for (uint32_t d=0; d<D; d++) {
+                min[d] = std::min(min[d], p[d]);
+                max[d] = std::max(max[d], p[d]);
+            }
         }
+
+        void extend(basic_aabb_t const& other) {
+            for (uint32_t d=0; d<D; d++) {
+                min[d] = std::min(min[d], other.min[d]);
+                max[d] = std::max(max[d], other.max[d]);
+            }
+        }
+    };
+
+    using point_t = basic_point_t<2>;
+    using aabb_t = basic_aabb_t<2>;
+    using point3_t = basic_point_t<3>;
+    using aabb3_t = basic_aabb_t<3>;
+
+    enum class split_policy_t : uint8_t {
+        midpoint, // split the nominal cell at its midpoint
+        centers,  // split the bounding box of the entry centers inside the cell at its midpoint
     };
+
+    struct build_options_t {
+        static constexpr uint32_t template_depth = uint32_t(-1);
+
+        uint32_t max_depth = template_depth; // template_depth uses the tree's MAX_DEPTH
+        uint32_t leaf_size = 1; // nodes with at most this many entries are not split further
+        split_policy_t split_policy = split_policy_t::midpoint;
+        uint32_t threads = 1; // > 1 builds sibling subtrees on separate threads, at most this many at once
+        bool compress_paths = false; // skip nodes whose entries all fall into one child
+    };
+
+    // the traversal is templated on a stats sink, the default one compiles away
+    struct no_stats_t {
+        void visit(bool) {}
+        void test(bool) {}
+    };
+
+#if defined(ALH_LOOSE_QUADTREE_STATS)
+    // traversal counters, per query or summed over many
+    struct query_stats_t {
+        uint64_t queries = 0;
+        uint64_t nodes_visited = 0;  // nodes whose box was tested against the query
+        uint64_t nodes_culled = 0;   // visited nodes rejected together with their subtree
+        uint64_t entries_tested = 0; // leaf entries whose box was tested
+        uint64_t hits = 0;           // tested entries that intersected the query
+
+        void visit(bool culled) { nodes_visited++; nodes_culled += culled; }
+        void test(bool hit) { entries_tested++; hits += hit; }
+
+        // share of tested entries that were not hits, i.e. how loose the leaves are for the query
+        double false_positive_ratio() const { return entries_tested ? double(entries_tested - hits) / entries_tested : 0.; }
+        double hit_ratio() const { return entries_tested ? double(hits) / entries_tested : 0.; }
+
+        query_stats_t &operator+=(query_stats_t const& other) {
+            queries += other.queries;
+            nodes_visited += other.nodes_visited;
+            nodes_culled += other.nodes_culled;
+            entries_tested += other.entries_tested;
+            hits += other.hits;
+            return *this;
+        }
+    };
+#endif
+
+    // result of loose_quadtree_t::analyze. volumes are areas for D = 2, computed in double
+    struct tree_report_t {
+        uint64_t n_nodes = 0;                     // reachable ones, rebuild_dirty may leave padding
+        uint64_t n_leaves = 0;
+        uint64_t n_entries = 0;
+        std::vector<uint64_t> nodes_per_depth;    // index is the depth, the root is at 0
+        std::vector<uint64_t> leaves_per_depth;
+        std::vector<uint64_t> leaf_size_log2;     // leaves with 2^i <= size < 2^(i+1) entries
+        uint64_t max_leaf_size = 0;
+        double mean_leaf_size = 0.;
+
+        // how far node boxes reach past their nominal cell, per axis and relative to the cell
+        // extent (axes with an empty cell are skipped). 0 means the node fits its cell
+        double mean_expansion = 0.;
+        double max_expansion = 0.;
+
+        // sum of the pairwise overlap volume of siblings over the sum of their volumes
+        double sibling_overlap = 0.;
+
+        // cost model for a query of the size passed to analyze placed uniformly over the root box:
+        // a node is entered with the probability that the query overlaps its box
+        double expected_nodes_visited = 0.;
+        double expected_entries_tested = 0.;
+    };
+
+    // bytes in use (size) and held (capacity) by one internal array
+    struct array_usage_t {
+        size_t used = 0;
+        size_t reserved = 0;
+    };
+
+    // result of loose_quadtree_t::memory_usage, the heap storage of the tree per array
+    struct memory_usage_t {
+        array_usage_t nodes;
+        array_usage_t node_bbs;
+        array_usage_t node_points_begin;
+        array_usage_t boxes;
+        array_usage_t query_list;
+        array_usage_t updates; // parent links, slots and dirty flags, only held once update was called
+        array_usage_t kinetic; // entry velocities and node velocity bounds of a kinetic build
+
+        size_t used() const { return nodes.used + node_bbs.used + node_points_begin.used + boxes.used + query_list.used + updates.used + kinetic.used; }
+        size_t reserved() const { return nodes.reserved + node_bbs.reserved + node_points_begin.reserved + boxes.reserved + query_list.reserved + updates.reserved + kinetic.reserved; }
+        size_t slack() const { return reserved() - used(); }
+    };
+
+    // flat, relocatable format written by loose_quadtree_t::serialize and read in place by
+    // loose_quadtree_view_t. the header is followed by the arrays, each aligned to flat_alignment
+    // and addressed by its byte offset from the start of the header. native endianness
+    static constexpr uint32_t flat_magic = 0x54514c41; // "ALQT"
+    static constexpr uint32_t flat_version = 1;
+    static constexpr uint64_t flat_alignment = 64;
+
+    enum class flat_scalar_t : uint32_t { unsigned_int, signed_int, floating_point };
+
+    struct flat_header_t {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t dimensions;
+        flat_scalar_t scalar_kind;
+        uint32_t scalar_size;
+        uint32_t payload_size;
+        uint64_t root;
+        uint64_t n_nodes;
+        uint64_t n_boxes;
+        uint64_t nodes_offset;             // n_nodes * 2^dimensions child ids
+        uint64_t node_bbs_offset;          // n_nodes boxes
+        uint64_t node_points_begin_offset; // n_nodes + 1 entry indices
+        uint64_t entry_bbs_offset;         // n_boxes boxes
+        uint64_t payloads_offset;          // n_boxes payloads
+        uint64_t size;                     // total size in bytes
+    };
+
+    // fills in the identity of the format and the offsets of all arrays
+    template<uint32_t D, typename S, typename P>
+    flat_header_t make_flat_header(uint64_t root, uint64_t n_nodes, uint64_t n_boxes) {
+        auto align = [](uint64_t offset) { return (offset + flat_alignment - 1) / flat_alignment * flat_alignment; };
+
+        flat_header_t h{};
+        h.magic = flat_magic;
+        h.version = flat_version;
+        h.dimensions = D;
+        h.scalar_kind = std::is_floating_point_v<S> ? flat_scalar_t::floating_point
+                      : std::is_signed_v<S> ? flat_scalar_t::signed_int : flat_scalar_t::unsigned_int;
+        h.scalar_size = sizeof(S);
+        h.payload_size = sizeof(P);
+        h.root = root;
+        h.n_nodes = n_nodes;
+        h.n_boxes = n_boxes;
+        h.nodes_offset = align(sizeof(flat_header_t));
+        h.node_bbs_offset = align(h.nodes_offset + n_nodes * (uint64_t(1) << D) * sizeof(uint64_t));
+        h.node_points_begin_offset = align(h.node_bbs_offset + n_nodes * sizeof(basic_aabb_t<D, S>));
+        h.entry_bbs_offset = align(h.node_points_begin_offset + (n_nodes + 1) * sizeof(uint64_t));
+        h.payloads_offset = align(h.entry_bbs_offset + n_boxes * sizeof(basic_aabb_t<D, S>));
+        h.size = align(h.payloads_offset + n_boxes * sizeof(P));
+        return h;
+    }
+
+    // writes n bytes followed by zero padding up to offset end
+    inline void flat_write(std::ostream &os, void const* data, uint64_t n, uint64_t &offset, uint64_t end) {
+        static constexpr char zeros[flat_alignment] = {};
+        os.write(static_cast<char const*>(data), n);
+        offset += n;
+        while (offset < end) {
+            uint64_t pad = std::min(end - offset, flat_alignment);
+            os.write(zeros, pad);
+            offset += pad;
+        }
+    }
 };
 
-template<typename T=void*, uint64_t MAX_DEPTH=4>
+// D = 2 gives a quadtree, D = 3 an octree (see loose_octree_t), S is the coordinate type.
+// Alloc is rebound for all internal vectors (see pmr_loose_quadtree_t)
+template<typename T=void*, uint64_t MAX_DEPTH=4, uint32_t D=2, typename S=float, typename Alloc=std::allocator<std::byte>>
 struct loose_quadtree_t {
 
     using id_t = uint64_t;
-    using point_t = typename loose_quadtree::point_t;
-    using aabb_t = typename loose_quadtree::aabb_t;
+    using allocator_type = Alloc;
+    using scalar_t = S;
+    using scalar_traits_t = typename loose_quadtree::scalar_traits_t<S>;
+    using point_t = typename loose_quadtree::basic_point_t<D, S>;
+    using aabb_t = typename loose_quadtree::basic_aabb_t<D, S>;
+    using split_policy_t = typename loose_quadtree::split_policy_t;
+    using build_options_t = typename loose_quadtree::build_options_t;
+
+    // what each entry stores and queries yield, T = void stores the input index instead of a payload
+    using payload_t = std::conditional_t<std::is_void_v<T>, id_t, T>;
 
     static constexpr id_t empty = id_t(-1);
-    static constexpr float inf = std::numeric_limits<float>::infinity();
+    static constexpr uint32_t n_children = 1u << D;
 
-    loose_quadtree_t(std::vector<aabb_t> const& in, std::vector<T> const& data) { build(in, data); }
+    template<typename U, typename A=Alloc>
+    using vector_t = std::vector<U, typename std::allocator_traits<A>::template rebind_alloc<U>>;
+
+    // empty tree whose storage comes from alloc, call build before querying
+    explicit loose_quadtree_t(allocator_type const& alloc)
+        : nodes(alloc), node_bbs(alloc), node_points_begin(alloc), boxes(alloc), query_list(alloc),
+          node_parent(alloc), node_cell(alloc), node_depth(alloc), node_dirty(alloc), dirty_nodes(alloc), slot_of(alloc), velocities(alloc), node_velocity(alloc) {}
+
+    template<typename U> requires std::same_as<U, T>
+    loose_quadtree_t(std::vector<aabb_t> const& in, std::vector<U> const& data, build_options_t const& opts = {},
+                     allocator_type const& alloc = {}) : loose_quadtree_t(alloc) {
+        build(in, data, opts);
+    }
 
-    void build(std::vector<aabb_t> const& in, std::vector<T> const& data) {
-        assert(in.size() > 0);
+    template<typename U> requires std::same_as<U, T>
+    loose_quadtree_t(std::vector<aabb_t> const& in, std::vector<U> &&data, build_options_t const& opts = {},
+                     allocator_type const& alloc = {}) : loose_quadtree_t(alloc) {
+        build(in, std::move(data), opts);
+    }
+
+    // payload-less tree (T = void), queries yield the index of each box in `in`
+    loose_quadtree_t(std::vector<aabb_t> const& in, build_options_t const& opts = {},
+                     allocator_type const& alloc = {}) requires std::is_void_v<T> : loose_quadtree_t(alloc) {
+        build(in, opts);
+    }
+
+    allocator_type get_allocator() const { return allocator_type(boxes.get_allocator()); }
+
+    template<typename U> requires std::same_as<U, T>
+    void build(std::vector<aabb_t> const& in, std::vector<U> const& data, build_options_t const& opts = {}) {
+        build(std::span<aabb_t const>(in), std::span<U const>(data), opts);
+    }
+
+    // moves the payloads out of data, which is left with moved-from elements
+    template<typename U> requires std::same_as<U, T>
+    void build(std::vector<aabb_t> const& in, std::vector<U> &&data, build_options_t const& opts = {}) {
+        assert(in.size() == data.size());
+
+        boxes.clear();
+        boxes.reserve(in.size());
+        for (size_t i=0; i<in.size(); i++) boxes.emplace_back(in[i], std::move(data[i]));
+
+        build_tree(opts);
+    }
+
+    template<typename U> requires std::same_as<U, T>
+    void build(std::span<aabb_t const> in, std::span<U const> data, build_options_t const& opts = {}) {
         assert(in.size() == data.size());
 
-        nodes.clear(); // note: maybe it's fine to just stomp the memory?
-        node_bbs.clear();
-        node_points_begin.clear();
         boxes.clear();
+        boxes.reserve(in.size());
+        for (size_t i=0; i<in.size(); i++) boxes.emplace_back(in[i], data[i]);
+
+        build_tree(opts);
+    }
 
-        // get box centers (from implicit conversion)
+    // builds from any sequence, box_of(*it) gives the box and data_of(*it) the payload, which is
+    // constructed straight into the tree. e.g. iterate over entity indices and read SoA columns
+    template<typename It, typename BoxProj, typename DataProj> requires (!std::is_void_v<T>)
+    void build(It first, It last, BoxProj &&box_of, DataProj &&data_of, build_options_t const& opts = {}) {
+        boxes.clear();
+        if constexpr (std::random_access_iterator<It>) boxes.reserve(last - first);
+        for (; first != last; ++first) boxes.emplace_back(box_of(*first), data_of(*first));
+
+        build_tree(opts);
+    }
+
+    void build(std::vector<aabb_t> const& in, build_options_t const& opts = {}) requires std::is_void_v<T> {
+        build(std::span<aabb_t const>(in), opts);
+    }
+
+    void build(std::span<aabb_t const> in, build_options_t const& opts = {}) requires std::is_void_v<T> {
+        boxes.clear();
         boxes.reserve(in.size());
-        boxes.insert(boxes.begin(), in.begin(), in.end());
-        
-        auto it_data = data.begin();
-        for (aabb_entry_t &box : boxes) box.data = *it_data++;
+        for (size_t i=0; i<in.size(); i++) boxes.emplace_back(in[i], id_t(i));
 
-        query_list.insert(query_list.begin(), in.size(), empty);
+        build_tree(opts);
+    }
 
-        // get bounding box of all centers
-        aabb = {{inf, inf}, {-inf, -inf}};
-        for (aabb_entry_t bb : boxes) {
-            aabb.min.x = std::min(aabb.min.x, bb.center.x);
-            aabb.min.y = std::min(aabb.min.y, bb.center.y);
-            aabb.max.x = std::max(aabb.max.x, bb.center.x);
-            aabb.max.y = std::max(aabb.max.y, bb.center.y);
-        }
-
-        root = build_recursive(aabb,
-                               &boxes.front(),
-                               &boxes.back()+1,
-                               MAX_DEPTH);
-        node_points_begin.push_back(boxes.size());
+    // payload-less build from any sequence, the query results count the position in [first, last)
+    template<typename It, typename BoxProj> requires std::is_void_v<T>
+    void build(It first, It last, BoxProj &&box_of, build_options_t const& opts = {}) {
+        boxes.clear();
+        if constexpr (std::random_access_iterator<It>) boxes.reserve(last - first);
+        for (id_t i=0; first != last; ++first, ++i) boxes.emplace_back(box_of(*first), i);
+
+        build_tree(opts);
+    }
+
+    // kinetic build (T = void): entry i moves by velocity[i] per unit of time, and every node also
+    // keeps the range of the velocities below it, so query_at answers for any time without a
+    // rebuild. the boxes are the positions at time 0. serialize writes the boxes at time 0 only
+    void build(std::vector<aabb_t> const& in, std::vector<point_t> const& velocity, build_options_t const& opts = {})
+        requires std::is_void_v<T> && std::is_floating_point_v<S> {
+        build(std::span<aabb_t const>(in), std::span<point_t const>(velocity), opts);
+    }
+
+    void build(std::span<aabb_t const> in, std::span<point_t const> velocity, build_options_t const& opts = {})
+        requires std::is_void_v<T> && std::is_floating_point_v<S> {
+        assert(in.size() == velocity.size());
+        build(in, opts);
+
+        velocities.resize(boxes.size());
+        for (id_t i=0; i<boxes.size(); i++) velocities[i] = velocity[boxes[i].data];
+        fit_velocities(0, nodes.size());
+    }
+
+    // moves the entry built from in[index] to bb (T = void, where every entry knows its input index).
+    // the node boxes on the way up are grown at once so queries stay correct. the first node whose
+    // cell (the one it was split from) holds the new center is marked for rebuild_dirty: the
+    // common ancestor of the old and the new place of the entry. entries that stay in their cell
+    // only dirty their leaf, an entry moving to another child of the root marks the root
+    void update(id_t index, aabb_t const& bb) requires std::is_void_v<T> {
+        prepare_updates();
+        assert(index < slot_of.size());
+        id_t slot = slot_of[index];
+        boxes[slot] = aabb_entry_t(bb, index);
+        point_t const& center = boxes[slot].center;
+
+        id_t leaf = leaf_of(slot);
+
+        id_t dirty = leaf;
+        while (!contains(node_cell[dirty], center) && empty != node_parent[dirty]) dirty = node_parent[dirty];
+        if (!node_dirty[dirty]) {
+            node_dirty[dirty] = 1;
+            dirty_nodes.push_back(dirty);
+        }
+
+        for (id_t nid = leaf; empty != nid && !contains(node_bbs[nid], bb); nid = node_parent[nid]) {
+            node_bbs[nid].extend(bb);
+        }
+    }
+
+    // same as update, also sets the velocity of the entry (kinetic builds only). the velocity
+    // bounds on the way up are widened at once, like the boxes
+    void update(id_t index, aabb_t const& bb, point_t const& velocity) requires std::is_void_v<T> && std::is_floating_point_v<S> {
+        assert(!velocities.empty() && "not a kinetic build");
+        update(index, bb);
+
+        id_t slot = slot_of[index];
+        velocities[slot] = velocity;
+        for (id_t nid = leaf_of(slot); empty != nid && !contains(node_velocity[nid], velocity); nid = node_parent[nid]) {
+            node_velocity[nid].extend(velocity);
+        }
+    }
+
+    // repartitions the subtrees marked by update and refits the boxes above them, all other
+    // subtrees keep their nodes. a marked root, or marked subtrees holding most of the entries,
+    // is a full build. each subtree is rebuilt over its own node range, see build_subtree.
+    // returns the number of entries that were repartitioned
+    size_t rebuild_dirty() requires std::is_void_v<T> {
+        std::sort(dirty_nodes.begin(), dirty_nodes.end());
+        if (!dirty_nodes.empty() && root == dirty_nodes.front()) {
+            rebuild_all();
+            return boxes.size();
+        }
+
+        // a rebuild covers the node range of its subtree, which holds every marked node below it.
+        // when the subtrees hold most of the entries a full build costs about the same
+        std::vector<id_t> tops;
+        size_t n_dirty = 0;
+        id_t covered = 0;
+        for (id_t nid : dirty_nodes) {
+            if (nid < covered) continue;
+            tops.push_back(nid);
+            n_dirty += subtree_end(nid) - node_points_begin[nid];
+            covered = node_range_end(nid);
+        }
+        if (2 * n_dirty > boxes.size()) {
+            rebuild_all();
+            return boxes.size();
+        }
+
+        // all subtrees are built before any is written back, so the ones that outgrew their range
+        // are padded in a single pass over the node arrays
+        std::vector<rebuild_t> rebuilds;
+        for (id_t nid : tops) rebuilds.push_back(build_subtree(nid));
+
+        std::vector<padding_t> paddings;
+        for (rebuild_t const& r : rebuilds) {
+            id_t n_sub = r.nodes.size();
+            if (n_sub <= r.node_end - r.nid) continue;
+            // a quarter of the new size stays as slack for the next time
+            id_t n = n_sub - (r.node_end - r.nid) + n_sub / 4;
+            paddings.push_back({r.node_end, n, n + (paddings.empty() ? 0 : paddings.back().shift)});
+        }
+        if (!paddings.empty()) {
+            insert_padding(paddings);
+            for (rebuild_t &r : rebuilds) {
+                r.nid = shifted(paddings, r.nid);
+                r.node_end = shifted(paddings, r.node_end);
+            }
+        }
+
+        size_t n_entries = 0;
+        for (rebuild_t const& r : rebuilds) {
+            write_subtree(r);
+            n_entries += r.last - r.first;
+        }
+        for (rebuild_t const& r : rebuilds) refit_ancestors(r.nid);
+
+        for (id_t nid : dirty_nodes) node_dirty[nid] = 0;
+        dirty_nodes.clear();
+        return n_entries;
     }
 
     struct query_iter_t {
         query_iter_t(loose_quadtree_t &tree, id_t head) : tree(tree), head(head) {}
         query_iter_t &operator++() { head = tree.query_list[head]; return *this; }
         //query_iter_t operator++(int);
-        
+
         friend bool operator==(query_iter_t const& lhs, query_iter_t const& rhs) {
-            return (lhs.head == rhs.head); 
+            return (lhs.head == rhs.head);
         }
-        
+
         friend bool operator!=(query_iter_t const& lhs, query_iter_t const& rhs) {
             return !(lhs == rhs);
         }
-        
-        T operator*() const { assert(head != empty); return tree.boxes[head].data; }
+
+        payload_t const& operator*() const { assert(head != empty); return tree.boxes[head].data; }
     private:
         loose_quadtree_t const& tree;
         id_t head;
@@ -94,115 +508,712 @@ struct loose_quadtree_t {
     // create linked-list with indices for query results
     query_iter_t query_start(aabb_t query_bb) {
         query_head = empty;
-        query_start_recursive(query_bb, root);
+#if defined(ALH_LOOSE_QUADTREE_STATS)
+        last_stats = query_stats_t{};
+        last_stats.queries = 1;
+        query_start_recursive(query_bb, root, last_stats);
+        total_stats += last_stats;
+#else
+        loose_quadtree::no_stats_t stats;
+        query_start_recursive(query_bb, root, stats);
+#endif
         return query_iter_t(*this, query_head);
     }
 
     // return sentinel value (placed at end of query by query_start)
     query_iter_t query_end() { return query_iter_t(*this, empty); }
 
+    // calls fn(payload) for every entry intersecting query_bb. unlike query_start this leaves
+    // the tree untouched, so any number of threads can query the same tree concurrently
+    template<typename F>
+    void query(aabb_t const& query_bb, F &&fn) const {
+        loose_quadtree::no_stats_t stats;
+        query_recursive(query_bb, root, fn, stats);
+    }
+
+    // writes the payloads intersecting query_bb into out and returns how many there are. when that
+    // is more than out.size() only the first out.size() are written, so the caller can retry with
+    // a buffer of the returned size. results come in leaf order, which is the order of boxes
+    size_t query_into(aabb_t const& query_bb, std::span<payload_t> out) const {
+        size_t n = 0;
+        query(query_bb, [&](payload_t const& data) {
+            if (n < out.size()) out[n] = data;
+            n++;
+        });
+        return n;
+    }
+
+    // same as above with no size limit, returns the iterator past the last payload written
+    template<std::output_iterator<payload_t const&> O>
+    O query_into(aabb_t const& query_bb, O out) const {
+        query(query_bb, [&](payload_t const& data) { *out++ = data; });
+        return out;
+    }
+
+    // calls fn(payload) once for every entry intersecting at least one of query_bbs, in a single
+    // traversal. each node only tests the boxes that overlapped its parent, and since every entry
+    // sits in exactly one leaf nothing is reported twice, however much the boxes overlap
+    template<typename F>
+    void query_any(std::span<aabb_t const> query_bbs, F &&fn) const {
+        if (query_bbs.empty()) return;
+
+        // indices of the boxes still overlapping, one run per level of the current path
+        std::vector<uint32_t> active;
+        active.reserve(query_bbs.size() * 4);
+        for (uint32_t k=0; k<query_bbs.size(); k++) active.push_back(k);
+        query_any_recursive(query_bbs, active, 0, root, fn);
+    }
+
+    // times of impact are fractions of the sweep, computed in double for integer coordinates
+    using toi_t = std::conditional_t<std::is_floating_point_v<S>, S, double>;
+
+    struct swept_hit_t {
+        toi_t toi;
+        payload_t data;
+    };
+
+    // calls fn(payload, toi) for every entry that box touches while moving by delta, toi in [0, 1]
+    // is the fraction of delta at which it first does (0 for entries it starts on). nodes are
+    // pruned by the same slab test along the motion, so a diagonal sweep does not visit
+    // everything under its bounding box. touching counts, results come in traversal order
+    template<typename F>
+    void query_swept(aabb_t const& box, point_t const& delta, F &&fn) const {
+        toi_t inv[D];
+        for (uint32_t d=0; d<D; d++) inv[d] = (0 == delta[d]) ? toi_t(0) : toi_t(1) / toi_t(delta[d]);
+        query_swept_recursive(box, delta, inv, root, fn);
+    }
+
+    // same as query_swept, but replaces the contents of hits with the results ordered by time of impact
+    void query_swept(aabb_t const& box, point_t const& delta, std::vector<swept_hit_t> &hits) const {
+        hits.clear();
+        query_swept(box, delta, [&](payload_t const& data, toi_t toi) { hits.push_back({toi, data}); });
+        std::stable_sort(hits.begin(), hits.end(), [](swept_hit_t const& a, swept_hit_t const& b) { return a.toi < b.toi; });
+    }
+
+    // calls fn(payload) for every entry of a kinetic build whose box, moved by t times its
+    // velocity, intersects query_bb. t may be negative. node boxes are moved by the extreme
+    // velocities below them, so they get looser the further t is from the build time
+    template<typename F>
+    void query_at(aabb_t const& query_bb, S t, F &&fn) const requires std::is_floating_point_v<S> {
+        assert(!velocities.empty() && "not a kinetic build");
+        query_at_recursive(query_bb, t, root, fn);
+    }
+
+#if defined(ALH_LOOSE_QUADTREE_STATS)
+    using query_stats_t = loose_quadtree::query_stats_t;
+
+    // same as query, also adds its counters to stats (one per thread when querying concurrently)
+    template<typename F>
+    void query(aabb_t const& query_bb, F &&fn, query_stats_t &stats) const {
+        stats.queries++;
+        query_recursive(query_bb, root, fn, stats);
+    }
+
+    // counters of the last query_start, and their sum over all query_start calls since the last reset
+    query_stats_t const& last_query_stats() const { return last_stats; }
+    query_stats_t const& total_query_stats() const { return total_stats; }
+    void reset_query_stats() { last_stats = total_stats = query_stats_t{}; }
+#endif
+
+    // walks the built tree and reports its shape, how loose the node boxes are and what a query
+    // of query_size is expected to cost, see loose_quadtree::tree_report_t
+    loose_quadtree::tree_report_t analyze(point_t const& query_size = {}) const {
+        loose_quadtree::tree_report_t report;
+        report.n_entries = boxes.size();
+
+        analyze_sums_t sums;
+        analyze_recursive(report, sums, query_size, root, aabb, 0);
+
+        if (sums.n_axes > 0) report.mean_expansion /= sums.n_axes;
+        if (sums.sibling_volume > 0.) report.sibling_overlap = sums.sibling_overlap / sums.sibling_volume;
+        if (report.n_leaves > 0) report.mean_leaf_size = double(report.n_entries) / report.n_leaves;
+        return report;
+    }
+
+    // heap bytes of the internal arrays, not counting sizeof(*this). rebuilding reuses capacity,
+    // so after building a smaller tree reserved can be well above used
+    loose_quadtree::memory_usage_t memory_usage() const {
+        auto usage = [](auto const& v) {
+            using value_t = typename std::decay_t<decltype(v)>::value_type;
+            return loose_quadtree::array_usage_t{v.size() * sizeof(value_t), v.capacity() * sizeof(value_t)};
+        };
+
+        loose_quadtree::memory_usage_t mu;
+        mu.nodes = usage(nodes);
+        mu.node_bbs = usage(node_bbs);
+        mu.node_points_begin = usage(node_points_begin);
+        mu.boxes = usage(boxes);
+        mu.query_list = usage(query_list);
+        for (auto u : {usage(node_parent), usage(node_cell), usage(node_depth), usage(node_dirty), usage(dirty_nodes), usage(slot_of)}) {
+            mu.updates.used += u.used;
+            mu.updates.reserved += u.reserved;
+        }
+        for (auto u : {usage(velocities), usage(node_velocity)}) {
+            mu.kinetic.used += u.used;
+            mu.kinetic.reserved += u.reserved;
+        }
+        return mu;
+    }
+
+    // releases the slack capacity of all arrays (a reallocation each, so with a monotonic
+    // resource the old storage is only returned when the resource is released)
+    void shrink_to_fit() {
+        nodes.shrink_to_fit();
+        node_bbs.shrink_to_fit();
+        node_points_begin.shrink_to_fit();
+        boxes.shrink_to_fit();
+        query_list.shrink_to_fit();
+        node_parent.shrink_to_fit();
+        node_cell.shrink_to_fit();
+        node_depth.shrink_to_fit();
+        node_dirty.shrink_to_fit();
+        dirty_nodes.shrink_to_fit();
+        slot_of.shrink_to_fit();
+        velocities.shrink_to_fit();
+        node_velocity.shrink_to_fit();
+    }
+
+    // writes the tree in the flat format (see loose_quadtree::flat_header_t), which
+    // loose_quadtree_view_t can query in place, e.g. from a memory-mapped file
+    void serialize(std::ostream &os) const {
+        static_assert(std::is_trivially_copyable_v<payload_t>, "payloads are stored bytewise");
+        static_assert(sizeof(node_t) == n_children * sizeof(uint64_t));
+
+        auto h = loose_quadtree::make_flat_header<D, S, payload_t>(root, nodes.size(), boxes.size());
+
+        uint64_t offset = 0;
+        loose_quadtree::flat_write(os, &h, sizeof(h), offset, h.nodes_offset);
+        loose_quadtree::flat_write(os, nodes.data(), nodes.size() * sizeof(node_t), offset, h.node_bbs_offset);
+        loose_quadtree::flat_write(os, node_bbs.data(), node_bbs.size() * sizeof(aabb_t), offset, h.node_points_begin_offset);
+        loose_quadtree::flat_write(os, node_points_begin.data(), node_points_begin.size() * sizeof(id_t), offset, h.entry_bbs_offset);
+
+        // entries are split into a box array and a payload array, gathered in chunks
+        static constexpr size_t chunk = 4096;
+        std::vector<aabb_t> bbs;
+        std::vector<payload_t> payloads;
+        for (size_t i=0; i<boxes.size(); i+=chunk) {
+            size_t n = std::min(chunk, boxes.size() - i);
+            bbs.clear();
+            for (size_t j=0; j<n; j++) bbs.push_back(boxes[i+j].aabb);
+            uint64_t end = (i + n == boxes.size()) ? h.payloads_offset : offset + n * sizeof(aabb_t);
+            loose_quadtree::flat_write(os, bbs.data(), n * sizeof(aabb_t), offset, end);
+        }
+        for (size_t i=0; i<boxes.size(); i+=chunk) {
+            size_t n = std::min(chunk, boxes.size() - i);
+            payloads.clear();
+            for (size_t j=0; j<n; j++) payloads.push_back(boxes[i+j].data);
+            uint64_t end = (i + n == boxes.size()) ? h.size : offset + n * sizeof(payload_t);
+            loose_quadtree::flat_write(os, payloads.data(), n * sizeof(payload_t), offset, end);
+        }
+    }
+
 private:
+    template<typename, uint64_t, uint32_t, typename>
+    friend struct loose_quadtree_external_builder_t;
+
+    // child i lies on the upper side of the split along axis d if bit d of i is set,
+    // for D = 2 the children are in nw, ne, sw, se order
     struct node_t {
-        id_t nw = empty;
-        id_t ne = empty;
-        id_t sw = empty;
-        id_t se = empty;
+        node_t() { std::fill(std::begin(child), std::end(child), empty); }
+        id_t child[n_children];
     };
 
     struct aabb_entry_t {
-        aabb_entry_t(aabb_t bb) {
-            aabb = bb;
-            center.x = (bb.min.x + bb.max.x) / 2.f;
-            center.y = (bb.min.y + bb.max.y) / 2.f;
+        template<typename U>
+        aabb_entry_t(aabb_t bb, U &&data) : aabb(bb), data(std::forward<U>(data)) {
+            for (uint32_t d=0; d<D; d++) center[d] = scalar_traits_t::mid(bb.min[d], bb.max[d]);
         }
         aabb_t aabb;
         point_t center;
-        T data;
+        payload_t data;
     };
 
-    static void split_4(aabb_t const& bb, aabb_t &bb1, aabb_t &bb2, aabb_t &bb3, aabb_t &bb4) {
+    static aabb_t empty_bb() {
+        aabb_t bb;
+        for (uint32_t d=0; d<D; d++) {
+            bb.min[d] = scalar_traits_t::highest();
+            bb.max[d] = scalar_traits_t::lowest();
+        }
+        return bb;
+    }
+
+    static void split(aabb_t const& bb, aabb_t (&cells)[n_children]) {
         point_t mid;
-        mid.x = (bb.min.x + bb.max.x) / 2.f;
-        mid.y = (bb.min.y + bb.max.y) / 2.f;
+        for (uint32_t d=0; d<D; d++) mid[d] = scalar_traits_t::mid(bb.min[d], bb.max[d]);
 
-        bb1.min.x = bb.min.x;
-        bb1.min.y = bb.min.y;
-        bb1.max.x = mid.x;
-        bb1.max.y = mid.y;
+        for (uint32_t i=0; i<n_children; i++) {
+            for (uint32_t d=0; d<D; d++) {
+                bool upper = (i >> d) & 1;
+                cells[i].min[d] = upper ? mid[d] : bb.min[d];
+                cells[i].max[d] = upper ? bb.max[d] : mid[d];
+            }
+        }
+    }
 
-        bb2.min.x = mid.x;
-        bb2.min.y = bb.min.y;
-        bb2.max.x = bb.max.x;
-        bb2.max.y = mid.y;
+    loose_quadtree_t() {}
+
+    // output of build_recursive, subtrees built on other threads get their own on the heap so that
+    // allocators which are not thread-safe (e.g. monotonic arenas) are only used by the calling thread
+    template<typename A>
+    struct build_target_t {
+        vector_t<node_t, A> &nodes;
+        vector_t<aabb_t, A> &node_bbs;
+        vector_t<id_t, A> &node_points_begin;
+    };
 
-        bb3.min.x = bb.min.x;
-        bb3.min.y = mid.y;
-        bb3.max.x = mid.x;
-        bb3.max.y = bb.max.y;
+    void build_tree(build_options_t opts) {
+        assert(boxes.size() > 0);
 
-        bb4.min.x = mid.x;
-        bb4.min.y = mid.y;
-        bb4.max.x = bb.max.x;
-        bb4.max.y = bb.max.y;
+        if (build_options_t::template_depth == opts.max_depth) opts.max_depth = MAX_DEPTH;
+        opts.leaf_size = std::max(opts.leaf_size, 1u);
+        opts.threads = std::max(opts.threads, 1u);
+        options = opts;
+
+        nodes.clear(); // note: maybe it's fine to just stomp the memory?
+        node_bbs.clear();
+        node_points_begin.clear();
+
+        // the update state is rebuilt by the next update
+        node_parent.clear();
+        node_cell.clear();
+        node_depth.clear();
+        node_dirty.clear();
+        dirty_nodes.clear();
+        slot_of.clear();
+        velocities.clear();
+        node_velocity.clear();
+
+        query_list.assign(boxes.size(), empty);
+
+        // get bounding box of all centers
+        aabb = empty_bb();
+        for (aabb_entry_t const& bb : boxes) aabb.extend(bb.center);
+
+        build_target_t<Alloc> out{nodes, node_bbs, node_points_begin};
+        root = build_dispatch(out, aabb, &boxes.front(), &boxes.back()+1, opts.max_depth);
+        node_points_begin.push_back(boxes.size());
     }
 
-    loose_quadtree_t() {}
+    // builds [begin, end) with the options of the last build,
+    // the default configuration gets its own instantiation with the leaf test folded
+    template<typename A>
+    id_t build_dispatch(build_target_t<A> &out, aabb_t const& bb, aabb_entry_t *begin, aabb_entry_t *end, uint32_t depth) {
+        build_options_t const& opts = options;
+        if (split_policy_t::midpoint == opts.split_policy && 1 == opts.leaf_size) {
+            return build_parallel<split_policy_t::midpoint, 1>(out, opts, bb, begin, end, depth, opts.threads);
+        } else if (split_policy_t::midpoint == opts.split_policy) {
+            return build_parallel<split_policy_t::midpoint, 0>(out, opts, bb, begin, end, depth, opts.threads);
+        } else {
+            return build_parallel<split_policy_t::centers, 0>(out, opts, bb, begin, end, depth, opts.threads);
+        }
+    }
 
-    id_t build_recursive(aabb_t const& bb, aabb_entry_t *begin, aabb_entry_t *end, uint32_t depth) {
-        if (begin == end) return empty;
+    static bool contains(aabb_t const& outer, aabb_t const& inner) {
+        for (uint32_t d=0; d<D; d++) {
+            if (!(outer.min[d] <= inner.min[d] && inner.max[d] <= outer.max[d])) return false;
+        }
+        return true;
+    }
+
+    static bool contains(aabb_t const& bb, point_t const& p) {
+        for (uint32_t d=0; d<D; d++) {
+            if (!(bb.min[d] <= p[d] && p[d] <= bb.max[d])) return false;
+        }
+        return true;
+    }
+
+    // parent links, depth budgets, dirty flags and the slot of every input index, set up by the
+    // first update after a build
+    void prepare_updates() {
+        if (!node_parent.empty()) return;
+
+        node_parent.assign(nodes.size(), empty);
+        for (id_t nid=0; nid<nodes.size(); nid++) {
+            for (id_t child : nodes[nid].child) if (empty != child) node_parent[child] = nid;
+        }
+        node_cell.assign(nodes.size(), empty_bb());
+        node_depth.assign(nodes.size(), 0);
+        fit_cells(root, aabb, options.max_depth);
+        node_dirty.assign(nodes.size(), 0);
+
+        slot_of.resize(boxes.size());
+        for (id_t i=0; i<boxes.size(); i++) slot_of[boxes[i].data] = i;
+    }
+
+    // padding left by rebuild_dirty, no children and no entries (built nodes are never empty)
+    bool is_dead(id_t nid) const {
+        for (id_t child : nodes[nid].child) if (empty != child) return false;
+        return node_points_begin[nid] == node_points_begin[nid+1];
+    }
+
+    // a subtree repartitioned by rebuild_dirty, built into its own arrays before it is written back
+    // over the node range [nid, node_end) (the nodes it used before and the padding after them)
+    struct rebuild_t {
+        using heap_t = std::allocator<std::byte>;
+
+        id_t nid;
+        id_t node_end;
+        id_t first, last; // entry range
+        aabb_t cell;
+        uint32_t depth;
+        vector_t<node_t, heap_t> nodes;
+        vector_t<aabb_t, heap_t> node_bbs;
+        vector_t<id_t, heap_t> node_points_begin;
+    };
 
-        id_t nid = nodes.size();
-        nodes.emplace_back();
+    // n padding nodes go in front of the node at, shift is the sum of n up to this one
+    struct padding_t {
+        id_t at;
+        id_t n;
+        id_t shift;
+    };
+
+    // end of the node range of the subtree of nid: past its last node in preorder and the padding after it
+    id_t node_range_end(id_t nid) const {
+        id_t node_end = nid;
+        for (id_t c = nid; empty != c;) {
+            node_end = c;
+            c = empty;
+            for (id_t child : nodes[node_end].child) if (empty != child) c = child;
+        }
+        node_end++;
+        while (node_end < nodes.size() && is_dead(node_end)) node_end++;
+        return node_end;
+    }
+
+    // rebuilds the subtree of nid over its own entry range from the cell and with the depth budget
+    // the node was built with, so it comes out as a fresh build would (update keeps the entries
+    // of a dirty node inside its cell). with compress_paths one link can stand for several
+    // levels, which is why the budget is not the number of ancestors
+    rebuild_t build_subtree(id_t nid) {
+        rebuild_t r;
+        r.nid = nid;
+        r.first = node_points_begin[nid];
+        r.last = subtree_end(nid);
+        r.node_end = node_range_end(nid);
+        r.depth = node_depth[nid];
+        r.cell = node_cell[nid];
+
+        build_target_t<typename rebuild_t::heap_t> out{r.nodes, r.node_bbs, r.node_points_begin};
+        id_t sub_root = build_dispatch(out, r.cell, &boxes[r.first], &boxes[r.first] + (r.last - r.first), r.depth);
+        assert(0 == sub_root);
+        (void)sub_root;
+        return r;
+    }
+
+    // writes a rebuilt subtree in preorder over its node range, the nodes it does not need become padding
+    void write_subtree(rebuild_t const& r) {
+        id_t nid = r.nid;
+        assert(r.nodes.size() <= r.node_end - nid);
+        for (id_t k=0; k<r.node_end-nid; k++) {
+            id_t n = nid + k;
+            if (k < r.nodes.size()) {
+                nodes[n] = r.nodes[k];
+                for (id_t &c : nodes[n].child) if (empty != c) c += nid;
+                node_bbs[n] = r.node_bbs[k];
+                node_points_begin[n] = r.node_points_begin[k];
+            } else {
+                nodes[n] = node_t();
+                node_bbs[n] = empty_bb();
+                node_points_begin[n] = r.last;
+            }
+            if (n != nid) node_parent[n] = empty;
+        }
+        for (id_t n=nid; n<nid+r.nodes.size(); n++) {
+            for (id_t child : nodes[n].child) if (empty != child) node_parent[child] = n;
+        }
+        fit_cells(nid, r.cell, r.depth);
+
+        if (!velocities.empty()) {
+            // velocities follow their entries, slot_of still holds the old slots
+            vector_t<point_t, typename rebuild_t::heap_t> gathered(r.last - r.first);
+            for (id_t i=r.first; i!=r.last; i++) gathered[i - r.first] = velocities[slot_of[boxes[i].data]];
+            std::copy(gathered.begin(), gathered.end(), velocities.begin() + r.first);
+            fit_velocities(nid, r.node_end);
+        }
+
+        for (id_t i=r.first; i!=r.last; i++) slot_of[boxes[i].data] = i;
+    }
+
+    // full build over the current entries, velocities follow their entries
+    void rebuild_all() {
+        vector_t<point_t> by_index(velocities.size(), velocities.get_allocator());
+        for (id_t i=0; i<velocities.size(); i++) by_index[boxes[i].data] = velocities[i];
+
+        build_tree(options);
+        if (by_index.empty()) return;
+
+        velocities.resize(boxes.size());
+        for (id_t i=0; i<boxes.size(); i++) velocities[i] = by_index[boxes[i].data];
+        fit_velocities(0, nodes.size());
+    }
+
+    // velocity bounds of the nodes in [first, last), children come after their parent in preorder
+    void fit_velocities(id_t first, id_t last) {
+        node_velocity.resize(nodes.size());
+        for (id_t nid=last; nid-- > first;) {
+            aabb_t v = empty_bb();
+            bool is_leaf = true;
+            for (id_t child : nodes[nid].child) {
+                if (empty != child) {
+                    v.extend(node_velocity[child]);
+                    is_leaf = false;
+                }
+            }
+            if (is_leaf) {
+                for (id_t i=node_points_begin[nid]; i!=node_points_begin[nid+1]; i++) v.extend(velocities[i]);
+            }
+            node_velocity[nid] = v;
+        }
+    }
+
+    // cells and depth budgets of the subtree of nid, built from cell with depth levels left.
+    // replays the splits, children get what is left after the levels the path compression skipped
+    void fit_cells(id_t nid, aabb_t const& cell, uint32_t depth) {
+        node_cell[nid] = cell;
+        node_depth[nid] = depth;
+
+        bool is_leaf = true;
+        for (id_t child : nodes[nid].child) is_leaf &= (empty == child);
+        if (is_leaf) return;
+
+        uint32_t skipped = 0;
+        aabb_t cells[n_children];
+        split(split_cell(cell, node_points_begin[nid], subtree_end(nid), skipped), cells);
+        assert(depth > skipped);
+        for (uint32_t i=0; i<n_children; i++) {
+            id_t child = nodes[nid].child[i];
+            if (empty != child) fit_cells(child, cells[i], depth - skipped - 1);
+        }
+    }
+
+    // the leaf of a slot is the last node in preorder that begins at or before it
+    id_t leaf_of(id_t slot) const {
+        auto first = node_points_begin.begin();
+        return std::upper_bound(first, first + nodes.size(), slot) - first - 1;
+    }
+
+    // id of a node after paddings were inserted, they are sorted by at
+    static id_t shifted(std::vector<padding_t> const& paddings, id_t nid) {
+        auto it = std::upper_bound(paddings.begin(), paddings.end(), nid, [](id_t n, padding_t const& p) { return n < p.at; });
+        return (paddings.begin() == it) ? nid : nid + std::prev(it)->shift;
+    }
+
+    // inserts all paddings and renumbers the nodes after them, one pass over each node array
+    void insert_padding(std::vector<padding_t> const& paddings) {
+        auto spread = [&](auto &v, auto const& fill) {
+            id_t src = v.size();
+            v.resize(v.size() + paddings.back().shift);
+            id_t dst = v.size();
+            for (size_t k=paddings.size(); k-- > 0;) {
+                padding_t const& p = paddings[k];
+                std::move_backward(v.begin() + p.at, v.begin() + src, v.begin() + dst);
+                dst -= src - p.at;
+                std::fill(v.begin() + (dst - p.n), v.begin() + dst, fill);
+                dst -= p.n;
+                src = p.at;
+            }
+        };
+        spread(nodes, node_t());
+        spread(node_bbs, empty_bb());
+        spread(node_parent, empty);
+        spread(node_cell, empty_bb());
+        spread(node_depth, 0u);
+        spread(node_dirty, uint8_t(0));
+        if (!node_velocity.empty()) spread(node_velocity, empty_bb());
+
+        // padding begins where the node after it does, like the nodes past the end of a subtree
+        spread(node_points_begin, id_t(0));
+        for (padding_t const& p : paddings) {
+            id_t end = p.at + p.shift;
+            std::fill(node_points_begin.begin() + (end - p.n), node_points_begin.begin() + end, node_points_begin[end]);
+        }
+
+        for (node_t &node : nodes) {
+            for (id_t &c : node.child) if (empty != c) c = shifted(paddings, c);
+        }
+        for (id_t &p : node_parent) if (empty != p) p = shifted(paddings, p);
+        for (id_t &d : dirty_nodes) d = shifted(paddings, d);
+    }
+
+    void refit_ancestors(id_t nid) {
+        for (id_t p = node_parent[nid]; empty != p; p = node_parent[p]) {
+            aabb_t bb = empty_bb();
+            for (id_t child : nodes[p].child) if (empty != child) bb.extend(node_bbs[child]);
+            node_bbs[p] = bb;
+
+            if (node_velocity.empty()) continue;
+            aabb_t v = empty_bb();
+            for (id_t child : nodes[p].child) if (empty != child) v.extend(node_velocity[child]);
+            node_velocity[p] = v;
+        }
+    }
+
+    template<typename A>
+    id_t push_node(build_target_t<A> &out, aabb_entry_t *begin, aabb_entry_t *end) {
+        id_t nid = out.nodes.size();
+        out.nodes.emplace_back();
 
         id_t idx = begin - &boxes.front();
         assert(idx >= 0 && idx < boxes.size());
-        node_points_begin.push_back(idx);
+        out.node_points_begin.push_back(idx);
 
         // compute bounding box for this node
-        aabb_t node_bb{{inf, inf}, {-inf, -inf}};
-        for (aabb_entry_t *it = begin; it != end; ++it) {
-            node_bb.min.x = std::min(node_bb.min.x, it->aabb.min.x);
-            node_bb.min.y = std::min(node_bb.min.y, it->aabb.min.y);
-            node_bb.max.x = std::max(node_bb.max.x, it->aabb.max.x);
-            node_bb.max.y = std::max(node_bb.max.y, it->aabb.max.y);
+        aabb_t node_bb = empty_bb();
+        for (aabb_entry_t *it = begin; it != end; ++it) node_bb.extend(it->aabb);
+        out.node_bbs.push_back(node_bb);
+
+        return nid;
+    }
+
+    // leaf test, LEAF_SIZE == 0 reads the leaf size from the options
+    template<uint32_t LEAF_SIZE>
+    static bool is_leaf(build_options_t const& opts, aabb_entry_t *begin, aabb_entry_t *end, uint32_t depth) {
+        uint64_t leaf_size = LEAF_SIZE ? LEAF_SIZE : opts.leaf_size;
+        return (uint64_t(end - begin) <= leaf_size || 0 == depth);
+    }
+
+    // partitions [begin, end) into child order and writes the range boundaries to splits,
+    // one std::partition pass per axis starting with the highest one
+    template<split_policy_t SPLIT>
+    static void partition(aabb_t const& bb, aabb_entry_t *begin, aabb_entry_t *end,
+                          aabb_entry_t *(&splits)[n_children+1], aabb_t (&cells)[n_children]) {
+        aabb_t cell = bb;
+        if constexpr (split_policy_t::centers == SPLIT) {
+            cell = empty_bb();
+            for (aabb_entry_t *it = begin; it != end; ++it) cell.extend(it->center);
         }
-        node_bbs.push_back(node_bb);
+        split(cell, cells);
 
-        if (begin+1 == end || 0 == depth) return nid;
+        point_t mid = cells[0].max;
 
-        aabb_t bb_nw, bb_ne, bb_sw, bb_se;
-        split_4(bb, bb_nw, bb_ne, bb_sw, bb_se);
+        splits[0] = begin;
+        splits[n_children] = end;
+        for (uint32_t d=D; d-- > 0;) {
+            uint32_t step = 1u << d;
+            auto is_lower = [mid, d](aabb_entry_t const& b){ return b.center[d] < mid[d]; };
+            for (uint32_t i=0; i<n_children; i+=2*step) {
+                splits[i+step] = std::partition(splits[i], splits[i+2*step], is_lower);
+            }
+        }
+    }
+
+    // partitions a node that is not a leaf, with compress_paths the partition descends through
+    // cells that hold all entries until one branches (depth is updated to match). the node keeps
+    // its tight bounding box, returns false if the chain hits max depth and the node becomes a leaf
+    template<split_policy_t SPLIT>
+    static bool split_node(build_options_t const& opts, aabb_t const& bb, aabb_entry_t *begin, aabb_entry_t *end,
+                           uint32_t &depth, aabb_entry_t *(&splits)[n_children+1], aabb_t (&cells)[n_children]) {
+        partition<SPLIT>(bb, begin, end, splits, cells);
+
+        while (opts.compress_paths) {
+            uint32_t n_nonempty = 0, last = 0;
+            for (uint32_t i=0; i<n_children; i++) {
+                if (splits[i] != splits[i+1]) { n_nonempty++; last = i; }
+            }
+            if (1 != n_nonempty) break;
+            if (0 == --depth) return false;
 
-        point_t mid = bb_nw.max;
-        auto is_top = [mid](aabb_entry_t const& b){ return b.center.y < mid.y; };
-        auto is_left = [mid](aabb_entry_t const& b){ return b.center.x < mid.x; };
+            aabb_t cell = cells[last];
+            partition<SPLIT>(cell, begin, end, splits, cells);
+        }
+
+        return true;
+    }
 
-        aabb_entry_t *split_y = std::partition(begin, end, is_top);
-        aabb_entry_t *split_x_upper = std::partition(begin, split_y, is_left);
-        aabb_entry_t *split_x_lower = std::partition(split_y, end, is_left);
+    template<split_policy_t SPLIT, uint32_t LEAF_SIZE, typename A>
+    id_t build_recursive(build_target_t<A> &out, build_options_t const& opts, aabb_t const& bb,
+                         aabb_entry_t *begin, aabb_entry_t *end, uint32_t depth) {
+        if (begin == end) return empty;
+
+        id_t nid = push_node(out, begin, end);
+        if (is_leaf<LEAF_SIZE>(opts, begin, end, depth)) return nid;
 
-        nodes[nid].nw = build_recursive(bb_nw, begin, split_x_upper, depth - 1);
-        nodes[nid].ne = build_recursive(bb_ne, split_x_upper, split_y, depth - 1);
-        nodes[nid].sw = build_recursive(bb_sw, split_y, split_x_lower, depth - 1);
-        nodes[nid].se = build_recursive(bb_se, split_x_lower, end, depth - 1);
+        aabb_entry_t *splits[n_children+1];
+        aabb_t cells[n_children];
+        if (!split_node<SPLIT>(opts, bb, begin, end, depth, splits, cells)) return nid;
+
+        for (uint32_t i=0; i<n_children; i++) {
+            id_t child = build_recursive<SPLIT, LEAF_SIZE>(out, opts, cells[i], splits[i], splits[i+1], depth - 1);
+            out.nodes[nid].child[i] = child;
+        }
 
         return nid;
     }
 
-    void query_start_recursive(aabb_t query_bb, id_t nid) {
-        if (query_bb.intersect(node_bbs[nid])) {
+    // same as build_recursive, but hands the children to other threads while threads > 1. no more
+    // than threads threads work on the subtree at any time, the calling one included
+    template<split_policy_t SPLIT, uint32_t LEAF_SIZE, typename A>
+    id_t build_parallel(build_target_t<A> &out, build_options_t const& opts, aabb_t const& bb,
+                        aabb_entry_t *begin, aabb_entry_t *end, uint32_t depth, uint32_t threads) {
+        if (threads <= 1) return build_recursive<SPLIT, LEAF_SIZE>(out, opts, bb, begin, end, depth);
+        if (begin == end) return empty;
+
+        id_t nid = push_node(out, begin, end);
+        if (is_leaf<LEAF_SIZE>(opts, begin, end, depth)) return nid;
+
+        aabb_entry_t *splits[n_children+1];
+        aabb_t cells[n_children];
+        if (!split_node<SPLIT>(opts, bb, begin, end, depth, splits, cells)) return nid;
+
+        using heap_t = std::allocator<std::byte>;
+        struct subtree_t {
+            vector_t<node_t, heap_t> nodes;
+            vector_t<aabb_t, heap_t> node_bbs;
+            vector_t<id_t, heap_t> node_points_begin;
+            id_t root;
+        } sub[n_children];
+
+        // threads is a budget: the children are split into at most that many contiguous groups,
+        // group g builds its children one after another with its share of the budget each, and
+        // group 0 runs on this thread
+        uint32_t n_groups = std::min<uint32_t>(threads, n_children);
+        auto build_group = [&](uint32_t g) {
+            uint32_t group_threads = threads / n_groups + (g < threads % n_groups);
+            for (uint32_t i=n_children*g/n_groups; i<n_children*(g+1)/n_groups; i++) {
+                build_target_t<heap_t> sub_out{sub[i].nodes, sub[i].node_bbs, sub[i].node_points_begin};
+                sub[i].root = build_parallel<SPLIT, LEAF_SIZE>(sub_out, opts, cells[i], splits[i], splits[i+1], depth - 1, group_threads);
+            }
+        };
+
+        std::thread workers[n_children-1];
+        for (uint32_t g=1; g<n_groups; g++) workers[g-1] = std::thread(build_group, g);
+        build_group(0);
+        for (uint32_t g=1; g<n_groups; g++) workers[g-1].join();
+
+        // append the subtrees in order so the node layout matches a serial build
+        for (uint32_t i=0; i<n_children; i++) {
+            id_t offset = out.nodes.size();
+            for (node_t n : sub[i].nodes) {
+                for (id_t &c : n.child) if (empty != c) c += offset;
+                out.nodes.push_back(n);
+            }
+            out.node_bbs.insert(out.node_bbs.end(), sub[i].node_bbs.begin(), sub[i].node_bbs.end());
+            out.node_points_begin.insert(out.node_points_begin.end(), sub[i].node_points_begin.begin(), sub[i].node_points_begin.end());
+            out.nodes[nid].child[i] = (empty == sub[i].root) ? empty : sub[i].root + offset;
+        }
+
+        return nid;
+    }
+
+    template<typename STATS>
+    void query_start_recursive(aabb_t const& query_bb, id_t nid, STATS &stats) {
+        bool overlaps = query_bb.intersect(node_bbs[nid]);
+        stats.visit(!overlaps);
+        if (overlaps) {
 
             bool is_not_leaf = false;
-            if (empty != nodes[nid].nw && (is_not_leaf=true)) query_start_recursive(query_bb, nodes[nid].nw);
-            if (empty != nodes[nid].ne && (is_not_leaf=true)) query_start_recursive(query_bb, nodes[nid].ne);
-            if (empty != nodes[nid].sw && (is_not_leaf=true)) query_start_recursive(query_bb, nodes[nid].sw);
-            if (empty != nodes[nid].se && (is_not_leaf=true)) query_start_recursive(query_bb, nodes[nid].se);
+            for (id_t child : nodes[nid].child) {
+                if (empty != child && (is_not_leaf=true)) query_start_recursive(query_bb, child, stats);
+            }
 
             if (!is_not_leaf) {
                 id_t i_front = node_points_begin[nid];
                 id_t i_back = node_points_begin[nid+1];
                 for (id_t i=i_front; i!=i_back; i++) {
-                    if (query_bb.intersect(boxes[i].aabb)) {
+                    bool hit = query_bb.intersect(boxes[i].aabb);
+                    stats.test(hit);
+                    if (hit) {
                         query_list[i] = query_head;
                         query_head = i;
                     }
@@ -211,20 +1222,308 @@ private:
         }
     }
 
+    template<typename F, typename STATS>
+    void query_recursive(aabb_t const& query_bb, id_t nid, F &fn, STATS &stats) const {
+        bool overlaps = query_bb.intersect(node_bbs[nid]);
+        stats.visit(!overlaps);
+        if (overlaps) {
+
+            bool is_not_leaf = false;
+            for (id_t child : nodes[nid].child) {
+                if (empty != child && (is_not_leaf=true)) query_recursive(query_bb, child, fn, stats);
+            }
+
+            if (!is_not_leaf) {
+                id_t i_front = node_points_begin[nid];
+                id_t i_back = node_points_begin[nid+1];
+                for (id_t i=i_front; i!=i_back; i++) {
+                    bool hit = query_bb.intersect(boxes[i].aabb);
+                    stats.test(hit);
+                    if (hit) fn(boxes[i].data);
+                }
+            }
+        }
+    }
+
+    // active[begin:] are the boxes that overlapped the parent, those overlapping nid are appended
+    // for the children and dropped again on the way back
+    template<typename F>
+    void query_any_recursive(std::span<aabb_t const> query_bbs, std::vector<uint32_t> &active, size_t begin, id_t nid, F &fn) const {
+        size_t end = active.size();
+        for (size_t k=begin; k<end; k++) {
+            if (query_bbs[active[k]].intersect(node_bbs[nid])) active.push_back(active[k]);
+        }
+        if (active.size() == end) return;
+
+        bool is_not_leaf = false;
+        for (id_t child : nodes[nid].child) {
+            if (empty != child && (is_not_leaf=true)) query_any_recursive(query_bbs, active, end, child, fn);
+        }
+
+        if (!is_not_leaf) {
+            id_t i_front = node_points_begin[nid];
+            id_t i_back = node_points_begin[nid+1];
+            for (id_t i=i_front; i!=i_back; i++) {
+                for (size_t k=end; k<active.size(); k++) {
+                    if (query_bbs[active[k]].intersect(boxes[i].aabb)) {
+                        fn(boxes[i].data);
+                        break;
+                    }
+                }
+            }
+        }
+        active.resize(end);
+    }
+
+    // slab test of box moving by delta against bb, on axis d the two touch while
+    // box.max + t*delta >= bb.min and box.min + t*delta <= bb.max. a bigger bb never gives a
+    // shorter interval (rounding is monotonic), so a node is entered whenever one of its entries hits
+    static bool sweep(aabb_t const& box, point_t const& delta, toi_t const (&inv)[D], aabb_t const& bb, toi_t &toi) {
+        toi_t enter = 0, exit = 1;
+        for (uint32_t d=0; d<D; d++) {
+            toi_t lo = toi_t(bb.min[d]) - toi_t(box.max[d]);
+            toi_t hi = toi_t(bb.max[d]) - toi_t(box.min[d]);
+            if (0 == delta[d]) {
+                if (lo > 0 || hi < 0) return false;
+                continue;
+            }
+            toi_t t0 = lo * inv[d], t1 = hi * inv[d];
+            if (t0 > t1) std::swap(t0, t1);
+            enter = std::max(enter, t0);
+            exit = std::min(exit, t1);
+            if (enter > exit) return false;
+        }
+        toi = enter;
+        return true;
+    }
+
+    template<typename F>
+    void query_swept_recursive(aabb_t const& box, point_t const& delta, toi_t const (&inv)[D], id_t nid, F &fn) const {
+        toi_t toi;
+        if (!sweep(box, delta, inv, node_bbs[nid], toi)) return;
+
+        bool is_not_leaf = false;
+        for (id_t child : nodes[nid].child) {
+            if (empty != child && (is_not_leaf=true)) query_swept_recursive(box, delta, inv, child, fn);
+        }
+
+        if (!is_not_leaf) {
+            id_t i_front = node_points_begin[nid];
+            id_t i_back = node_points_begin[nid+1];
+            for (id_t i=i_front; i!=i_back; i++) {
+                if (sweep(box, delta, inv, boxes[i].aabb, toi)) fn(boxes[i].data, toi);
+            }
+        }
+    }
+
+    // bb moved by t times a velocity in [v.min, v.max], the box it stays in whatever the velocity
+    static aabb_t moved(aabb_t bb, aabb_t const& v, S t) {
+        for (uint32_t d=0; d<D; d++) {
+            bb.min[d] += t * ((t >= S(0)) ? v.min[d] : v.max[d]);
+            bb.max[d] += t * ((t >= S(0)) ? v.max[d] : v.min[d]);
+        }
+        return bb;
+    }
+
+    template<typename F>
+    void query_at_recursive(aabb_t const& query_bb, S t, id_t nid, F &fn) const {
+        if (!query_bb.intersect(moved(node_bbs[nid], node_velocity[nid], t))) return;
+
+        bool is_not_leaf = false;
+        for (id_t child : nodes[nid].child) {
+            if (empty != child && (is_not_leaf=true)) query_at_recursive(query_bb, t, child, fn);
+        }
+
+        if (!is_not_leaf) {
+            id_t i_front = node_points_begin[nid];
+            id_t i_back = node_points_begin[nid+1];
+            for (id_t i=i_front; i!=i_back; i++) {
+                aabb_t bb = boxes[i].aabb;
+                for (uint32_t d=0; d<D; d++) {
+                    bb.min[d] += t * velocities[i][d];
+                    bb.max[d] += t * velocities[i][d];
+                }
+                if (query_bb.intersect(bb)) fn(boxes[i].data);
+            }
+        }
+    }
+
+    static double volume(aabb_t const& bb) {
+        double v = 1.;
+        for (uint32_t d=0; d<D; d++) v *= std::max(0., double(bb.max[d]) - double(bb.min[d]));
+        return v;
+    }
+
+    // index of the entry range past the subtree of nid, the last child comes last in preorder
+    id_t subtree_end(id_t nid) const {
+        for (;;) {
+            id_t last = empty;
+            for (id_t child : nodes[nid].child) if (empty != child) last = child;
+            if (empty == last) return node_points_begin[nid+1];
+            nid = last;
+        }
+    }
+
+    // the cell the children of an inner node were split from, replays partition and split_node.
+    // subtrees rebuilt by rebuild_dirty start from the cell of their node, so it holds for them too
+    aabb_t split_cell(aabb_t cell, id_t first, id_t last) const {
+        uint32_t skipped;
+        return split_cell(cell, first, last, skipped);
+    }
+
+    // same, skipped is set to the number of levels the path compression descended through
+    aabb_t split_cell(aabb_t cell, id_t first, id_t last, uint32_t &skipped) const {
+        skipped = 0;
+        if (split_policy_t::centers == options.split_policy) {
+            cell = empty_bb();
+            for (id_t i=first; i!=last; i++) cell.extend(boxes[i].center);
+            return cell;
+        }
+
+        auto child_of = [](point_t const& mid, point_t const& p) {
+            uint32_t i = 0;
+            for (uint32_t d=0; d<D; d++) i |= uint32_t(!(p[d] < mid[d])) << d;
+            return i;
+        };
+
+        for (uint32_t level=0; options.compress_paths && level<options.max_depth; level++) {
+            aabb_t cells[n_children];
+            split(cell, cells);
+            uint32_t k = child_of(cells[0].max, boxes[first].center);
+            for (id_t i=first+1; i!=last; i++) {
+                if (k != child_of(cells[0].max, boxes[i].center)) return cell;
+            }
+            cell = cells[k];
+            skipped++;
+        }
+        return cell;
+    }
+
+    // probability that a query of query_size placed uniformly over the root box overlaps bb
+    double overlap_probability(aabb_t const& bb, point_t const& query_size) const {
+        aabb_t const& domain = node_bbs[root];
+        double p = 1.;
+        for (uint32_t d=0; d<D; d++) {
+            double q = double(query_size[d]);
+            double num = std::max(0., double(bb.max[d]) - double(bb.min[d])) + q;
+            double den = std::max(0., double(domain.max[d]) - double(domain.min[d])) + q;
+            if (den > 0.) p *= std::min(1., num / den);
+        }
+        return p;
+    }
+
+    struct analyze_sums_t {
+        uint64_t n_axes = 0;
+        double sibling_overlap = 0.;
+        double sibling_volume = 0.;
+    };
+
+    void analyze_recursive(loose_quadtree::tree_report_t &report, analyze_sums_t &sums, point_t const& query_size,
+                           id_t nid, aabb_t const& cell, uint32_t depth) const {
+        aabb_t const& bb = node_bbs[nid];
+
+        if (report.nodes_per_depth.size() <= depth) {
+            report.nodes_per_depth.resize(depth + 1, 0);
+            report.leaves_per_depth.resize(depth + 1, 0);
+        }
+        report.nodes_per_depth[depth]++;
+        report.n_nodes++;
+
+        for (uint32_t d=0; d<D; d++) {
+            double extent = double(cell.max[d]) - double(cell.min[d]);
+            if (extent <= 0.) continue;
+            double over = std::max(0., double(cell.min[d]) - double(bb.min[d]))
+                        + std::max(0., double(bb.max[d]) - double(cell.max[d]));
+            report.mean_expansion += over / extent;
+            report.max_expansion = std::max(report.max_expansion, over / extent);
+            sums.n_axes++;
+        }
+
+        double p = overlap_probability(bb, query_size);
+        if (root == nid) report.expected_nodes_visited += 1.;
+
+        uint32_t n_inner = 0;
+        for (id_t child : nodes[nid].child) n_inner += (empty != child);
+
+        if (0 == n_inner) {
+            uint64_t size = node_points_begin[nid+1] - node_points_begin[nid];
+            uint32_t bucket = 0;
+            while ((uint64_t(2) << bucket) <= size) bucket++;
+            if (report.leaf_size_log2.size() <= bucket) report.leaf_size_log2.resize(bucket + 1, 0);
+            report.leaf_size_log2[bucket]++;
+
+            report.n_leaves++;
+            report.leaves_per_depth[depth]++;
+            report.max_leaf_size = std::max(report.max_leaf_size, size);
+            report.expected_entries_tested += p * size;
+            return;
+        }
+
+        report.expected_nodes_visited += p * n_inner;
+
+        aabb_t cells[n_children];
+        split(split_cell(cell, node_points_begin[nid], subtree_end(nid)), cells);
+
+        for (uint32_t i=0; i<n_children; i++) {
+            id_t a = nodes[nid].child[i];
+            if (empty == a) continue;
+            sums.sibling_volume += volume(node_bbs[a]);
+            for (uint32_t j=i+1; j<n_children; j++) {
+                id_t b = nodes[nid].child[j];
+                if (empty == b) continue;
+                aabb_t both = node_bbs[a];
+                for (uint32_t d=0; d<D; d++) {
+                    both.min[d] = std::max(both.min[d], node_bbs[b].min[d]);
+                    both.max[d] = std::min(both.max[d], node_bbs[b].max[d]);
+                }
+                sums.sibling_overlap += volume(both);
+            }
+        }
+        for (uint32_t i=0; i<n_children; i++) {
+            id_t child = nodes[nid].child[i];
+            if (empty != child) analyze_recursive(report, sums, query_size, child, cells[i], depth + 1);
+        }
+    }
+
     id_t root;
     aabb_t aabb;
     id_t query_head;
+    build_options_t options; // as used by the last build, normalized
 
     // per-node data
-    std::vector<node_t> nodes;
-    std::vector<aabb_t> node_bbs;
-    std::vector<id_t> node_points_begin;
+    vector_t<node_t> nodes;
+    vector_t<aabb_t> node_bbs;
+    vector_t<id_t> node_points_begin;
 
     // per-point data
-    std::vector<aabb_entry_t> boxes;
-    std::vector<id_t> query_list;
+    vector_t<aabb_entry_t> boxes;
+    vector_t<id_t> query_list;
+
+#if defined(ALH_LOOSE_QUADTREE_STATS)
+    query_stats_t last_stats;
+    query_stats_t total_stats;
+#endif
+
+    // update state, empty until the first update after a build
+    vector_t<id_t> node_parent;
+    vector_t<aabb_t> node_cell;    // cell each node was split from, see fit_cells
+    vector_t<uint32_t> node_depth; // depth budget each node was built with
+    vector_t<uint8_t> node_dirty;
+    vector_t<id_t> dirty_nodes;
+    vector_t<id_t> slot_of; // input index -> position in boxes
+
+    // kinetic builds, velocity of each entry and the bounds of the velocities below each node
+    vector_t<point_t> velocities;
+    vector_t<aabb_t> node_velocity;
 };
 
+template<typename T=void*, uint64_t MAX_DEPTH=4, typename S=float>
+using loose_octree_t = loose_quadtree_t<T, MAX_DEPTH, 3, S>;
+
+// storage from a std::pmr::memory_resource, e.g. a per-frame std::pmr::monotonic_buffer_resource
+template<typename T=void*, uint64_t MAX_DEPTH=4, uint32_t D=2, typename S=float>
+using pmr_loose_quadtree_t = loose_quadtree_t<T, MAX_DEPTH, D, S, std::pmr::polymorphic_allocator<std::byte>>;
+
 };
 
-#endif
\ No newline at end of file
+#endif
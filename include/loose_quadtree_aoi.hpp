@@ -0,0 +1,123 @@
+#ifndef ALH_LOOSE_QUADTREE_AOI_HPP
+#define ALH_LOOSE_QUADTREE_AOI_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "loose_quadtree.hpp"
+
+namespace alh {
+
+// area-of-interest subscriptions over any tree with a const query(bb, fn), e.g. loose_quadtree_t
+// or loose_cell_quadtree_t. every subscriber is a persistent region. update() queries all of
+// them, in parallel if asked, and diffs each sorted result against the one from the last
+// update into entered and left lists. the payloads have to identify entities across ticks
+// (entity ids, or input indices when the input order is stable) and must be ordered
+template<typename TREE>
+    requires std::totally_ordered<typename TREE::payload_t>
+struct loose_quadtree_aoi_t {
+
+    using tree_t = TREE;
+    using id_t = uint64_t;
+    using aabb_t = typename tree_t::aabb_t;
+    using payload_t = typename tree_t::payload_t;
+
+    // the region is first evaluated by the next update, where all of its entities enter
+    id_t subscribe(aabb_t const& region) {
+        id_t sub;
+        if (!free_subs.empty()) {
+            sub = free_subs.back();
+            free_subs.pop_back();
+        } else {
+            sub = subs.size();
+            subs.emplace_back();
+        }
+        subs[sub].region = region;
+        subs[sub].live = true;
+        n_live++;
+        return sub;
+    }
+
+    // the ids of unsubscribed regions are reused
+    void unsubscribe(id_t sub) {
+        assert(is_live(sub));
+        subs[sub] = subscriber_t{};
+        free_subs.push_back(sub);
+        n_live--;
+    }
+
+    void set_region(id_t sub, aabb_t const& region) { assert(is_live(sub)); subs[sub].region = region; }
+    aabb_t const& region(id_t sub) const { assert(is_live(sub)); return subs[sub].region; }
+
+    size_t size() const { return n_live; }
+
+    // queries every region and replaces the entered/left lists. subscribers are split in
+    // contiguous chunks between threads, each with its own scratch, the tree is only read
+    void update(tree_t const& tree, uint32_t threads = 1) {
+        threads = std::max(threads, 1u);
+        threads = uint32_t(std::min<size_t>(threads, std::max<size_t>(subs.size() / min_chunk, 1)));
+        scratch.resize(threads);
+
+        auto run = [&](uint32_t t) {
+            size_t begin = subs.size() * t / threads, end = subs.size() * (t+1) / threads;
+            for (size_t i=begin; i<end; i++) {
+                if (subs[i].live) update_one(tree, subs[i], scratch[t]);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (uint32_t t=1; t<threads; t++) workers.emplace_back(run, t);
+        run(0);
+        for (std::thread &w : workers) w.join();
+    }
+
+    // payloads that came into or went out of the region with the last update, in ascending order
+    std::span<payload_t const> entered(id_t sub) const { assert(is_live(sub)); return subs[sub].entered; }
+    std::span<payload_t const> left(id_t sub) const { assert(is_live(sub)); return subs[sub].left; }
+
+    // everything inside the region as of the last update, in ascending order
+    std::span<payload_t const> current(id_t sub) const { assert(is_live(sub)); return subs[sub].current; }
+
+private:
+    static constexpr size_t min_chunk = 64;
+
+    struct subscriber_t {
+        aabb_t region{};
+        bool live = false;
+        std::vector<payload_t> current;
+        std::vector<payload_t> entered;
+        std::vector<payload_t> left;
+    };
+
+    bool is_live(id_t sub) const { return sub < subs.size() && subs[sub].live; }
+
+    static void update_one(tree_t const& tree, subscriber_t &s, std::vector<payload_t> &next) {
+        next.clear();
+        tree.query(s.region, [&](payload_t const& p) { next.push_back(p); });
+        std::sort(next.begin(), next.end());
+
+        s.entered.clear();
+        s.left.clear();
+        std::set_difference(next.begin(), next.end(), s.current.begin(), s.current.end(), std::back_inserter(s.entered));
+        std::set_difference(s.current.begin(), s.current.end(), next.begin(), next.end(), std::back_inserter(s.left));
+
+        // the old set becomes the next scratch, both keep their capacity
+        s.current.swap(next);
+    }
+
+    std::vector<subscriber_t> subs;
+    std::vector<id_t> free_subs;
+    size_t n_live = 0;
+
+    std::vector<std::vector<payload_t>> scratch; // one per thread
+};
+
+};
+
+#endif
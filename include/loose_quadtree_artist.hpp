@@ -16,6 +16,7 @@ struct loose_quadtree_artist_t {
     using aabb_t = typename loose_quadtree_t<T, MAX_DEPTH>::aabb_t;
 
     static constexpr id_t empty = loose_quadtree_t<T, MAX_DEPTH>::empty;
+    static constexpr uint32_t n_children = loose_quadtree_t<T, MAX_DEPTH>::n_children;
 
     loose_quadtree_artist_t(loose_quadtree_t<T, MAX_DEPTH> &tree) : tree(tree) {}
 
@@ -36,14 +37,14 @@ private:
                            bb.max.x - bb.min.x,
                            bb.max.y - bb.min.y,
                            {130, 130, 130, 255});
-        aabb_t bb_nw, bb_ne, bb_sw, bb_se;
-        tree.split_4(bb, bb_nw, bb_ne, bb_sw, bb_se);
+        aabb_t cells[n_children];
+        tree.split(bb, cells);
 
         bool is_not_leaf = false;
-        if (empty != tree.nodes[nid].nw && (is_not_leaf=true)) draw_recursive(tree.nodes[nid].nw, bb_nw);
-        if (empty != tree.nodes[nid].ne && (is_not_leaf=true)) draw_recursive(tree.nodes[nid].ne, bb_ne);
-        if (empty != tree.nodes[nid].sw && (is_not_leaf=true)) draw_recursive(tree.nodes[nid].sw, bb_sw);
-        if (empty != tree.nodes[nid].se && (is_not_leaf=true)) draw_recursive(tree.nodes[nid].se, bb_se);
+        for (uint32_t i=0; i<n_children; i++) {
+            auto child = tree.nodes[nid].child[i];
+            if (empty != child && (is_not_leaf=true)) draw_recursive(child, cells[i]);
+        }
 
         if (!is_not_leaf) {
             auto start_inc = tree.node_points_begin[nid];
@@ -62,10 +63,9 @@ private:
 
     void draw_query_recursive(id_t nid, aabb_t query_bb) {
         if (query_bb.intersect(tree.node_bbs[nid])) {
-            if (empty != tree.nodes[nid].nw) draw_query_recursive(tree.nodes[nid].nw, query_bb);
-            if (empty != tree.nodes[nid].ne) draw_query_recursive(tree.nodes[nid].ne, query_bb);
-            if (empty != tree.nodes[nid].sw) draw_query_recursive(tree.nodes[nid].sw, query_bb);
-            if (empty != tree.nodes[nid].se) draw_query_recursive(tree.nodes[nid].se, query_bb);
+            for (auto child : tree.nodes[nid].child) {
+                if (empty != child) draw_query_recursive(child, query_bb);
+            }
 
             auto bb = tree.node_bbs[nid];
             DrawRectangleLines(bb.min.x,
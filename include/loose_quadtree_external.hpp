@@ -0,0 +1,376 @@
+#ifndef ALH_LOOSE_QUADTREE_EXTERNAL_HPP
+#define ALH_LOOSE_QUADTREE_EXTERNAL_HPP
+
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "loose_quadtree.hpp"
+
+namespace alh {
+
+// out-of-core build for inputs larger than memory. boxes are streamed in with add(), bucketed by
+// their cell at bucket_depth into temporary files, and finish() builds the buckets one at a time
+// and writes the result in the flat format of loose_quadtree_view_t. only one bucket is in memory
+// at a time, so bucket_depth should be chosen such that every bucket fits. the buckets are
+// buffered in memory and appended to their files in batches, so no more than one file is open
+// at any time whatever the number of buckets
+template<typename T=void*, uint64_t MAX_DEPTH=4, uint32_t D=2, typename S=float>
+struct loose_quadtree_external_builder_t {
+
+    using tree_t = loose_quadtree_t<T, MAX_DEPTH, D, S>;
+    using id_t = typename tree_t::id_t;
+    using payload_t = typename tree_t::payload_t;
+    using aabb_t = typename tree_t::aabb_t;
+    using build_options_t = typename tree_t::build_options_t;
+    using scalar_traits_t = typename tree_t::scalar_traits_t;
+
+    static constexpr id_t empty = tree_t::empty;
+    static constexpr uint32_t n_children = tree_t::n_children;
+
+    struct options_t {
+        aabb_t bounds;                 // nominal root cell, centers outside it go to the border buckets
+        uint32_t bucket_depth = 2;     // buckets are the 2^(D * bucket_depth) cells at this depth, at most 2^24
+        uint64_t buffer_bytes = 64 << 20; // buffered bucket data is appended to the files past this
+        std::filesystem::path temp_dir = std::filesystem::temp_directory_path();
+        build_options_t build = {};    // used for the subtree of each bucket
+    };
+
+    explicit loose_quadtree_external_builder_t(options_t const& opts) : opts(opts) {
+        static_assert(std::is_trivially_copyable_v<payload_t>, "payloads are stored bytewise");
+        // every bucket costs a few words of bookkeeping even when it is empty
+        assert(opts.bucket_depth * D <= 24 && "too many buckets");
+
+        uint64_t n_buckets = uint64_t(1) << (D * opts.bucket_depth);
+        bucket_buffers.resize(n_buckets);
+        bucket_spilled.assign(n_buckets, 0);
+        bucket_counts.assign(n_buckets, 0);
+        prefix = "alqt_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())
+               + "_" + std::to_string(reinterpret_cast<uintptr_t>(this)) + "_";
+    }
+
+    ~loose_quadtree_external_builder_t() {
+        std::error_code ec;
+        for (uint64_t b=0; b<bucket_spilled.size(); b++) {
+            if (bucket_spilled[b]) std::filesystem::remove(bucket_path(b), ec);
+        }
+        for (char const* name : {"nodes", "node_bbs", "node_points_begin", "entry_bbs", "payloads"}) {
+            std::filesystem::remove(temp_path(name), ec);
+        }
+    }
+
+    loose_quadtree_external_builder_t(loose_quadtree_external_builder_t const&) = delete;
+    loose_quadtree_external_builder_t &operator=(loose_quadtree_external_builder_t const&) = delete;
+
+    void add(std::span<aabb_t const> in, std::span<payload_t const> data) requires (!std::is_void_v<T>) {
+        assert(in.size() == data.size());
+        for (size_t i=0; i<in.size(); i++) add_one(in[i], data[i]);
+    }
+
+    // payload-less trees number the boxes in the order they are added
+    void add(std::span<aabb_t const> in) requires std::is_void_v<T> {
+        for (size_t i=0; i<in.size(); i++) add_one(in[i], n_boxes);
+    }
+
+    // builds all buckets and writes the tree. returns false on i/o errors, see error()
+    bool finish(std::ostream &os) {
+        if (!failure.empty()) return false;
+
+        // number the top-level nodes (one per non-empty cell above the buckets) in preorder
+        uint32_t depth = opts.bucket_depth;
+        top_ids.assign(depth, {});
+        for (uint32_t l=0; l<depth; l++) top_ids[l].assign(uint64_t(1) << (D * l), empty);
+        uint64_t n_top = (n_boxes > 0 && depth > 0) ? number_top(0, 0, 0) : 0;
+
+        // build the buckets in order and append their arrays to temporary files
+        errno = 0;
+        std::ofstream nodes_out(temp_path("nodes"), std::ios::binary);
+        std::ofstream node_bbs_out(temp_path("node_bbs"), std::ios::binary);
+        std::ofstream node_points_out(temp_path("node_points_begin"), std::ios::binary);
+        std::ofstream entry_bbs_out(temp_path("entry_bbs"), std::ios::binary);
+        std::ofstream payloads_out(temp_path("payloads"), std::ios::binary);
+        if (!nodes_out || !node_bbs_out || !node_points_out || !entry_bbs_out || !payloads_out) {
+            return fail("cannot create the temporary node and entry files in " + opts.temp_dir.string());
+        }
+
+        build_options_t sub_opts = opts.build;
+        uint32_t max_depth = (build_options_t::template_depth == sub_opts.max_depth) ? MAX_DEPTH : sub_opts.max_depth;
+        sub_opts.max_depth = (max_depth > depth) ? max_depth - depth : 0;
+
+        uint64_t n_buckets = bucket_counts.size();
+        bucket_roots.assign(n_buckets, empty);
+        bucket_bbs.assign(n_buckets, aabb_t{});
+        bucket_begins.assign(n_buckets, 0);
+
+        uint64_t n_sub_nodes = 0, n_written = 0;
+        std::vector<aabb_t> bbs;
+        std::vector<payload_t> payloads;
+        for (uint64_t b=0; b<n_buckets; b++) {
+            if (0 == bucket_counts[b]) continue;
+            if (!read_bucket(b, bbs, payloads)) return false;
+
+            sub_tree_t sub(bbs, std::move(payloads), sub_opts);
+
+            id_t node_offset = n_top + n_sub_nodes;
+            for (auto n : sub.nodes) {
+                for (id_t &c : n.child) if (empty != c) c += node_offset;
+                nodes_out.write(reinterpret_cast<char const*>(&n), sizeof(n));
+            }
+            node_bbs_out.write(reinterpret_cast<char const*>(sub.node_bbs.data()), sub.node_bbs.size() * sizeof(aabb_t));
+            for (size_t i=0; i+1<sub.node_points_begin.size(); i++) {
+                id_t begin = sub.node_points_begin[i] + n_written;
+                node_points_out.write(reinterpret_cast<char const*>(&begin), sizeof(begin));
+            }
+            for (auto const& e : sub.boxes) {
+                entry_bbs_out.write(reinterpret_cast<char const*>(&e.aabb), sizeof(aabb_t));
+                payloads_out.write(reinterpret_cast<char const*>(&e.data), sizeof(payload_t));
+            }
+
+            bucket_roots[b] = sub.root + node_offset;
+            bucket_bbs[b] = sub.node_bbs[sub.root];
+            bucket_begins[b] = n_written;
+            n_sub_nodes += sub.nodes.size();
+            n_written += sub.boxes.size();
+
+            payloads.clear();
+        }
+
+        nodes_out.close();
+        node_bbs_out.close();
+        node_points_out.close();
+        entry_bbs_out.close();
+        payloads_out.close();
+        if (!nodes_out || !node_bbs_out || !node_points_out || !entry_bbs_out || !payloads_out) {
+            return fail("cannot write the temporary node and entry files in " + opts.temp_dir.string());
+        }
+
+        // the top-level nodes go first, followed by the buckets' subtrees
+        top_nodes.assign(n_top, node_t());
+        top_bbs.assign(n_top, aabb_t{});
+        top_points_begin.assign(n_top, 0);
+        id_t root = empty;
+        if (n_top > 0) {
+            fill_top(0, 0);
+            root = 0;
+        } else {
+            for (id_t r : bucket_roots) if (empty != r) root = r;
+        }
+
+        auto h = loose_quadtree::make_flat_header<D, S, payload_t>(root, n_top + n_sub_nodes, n_written);
+        uint64_t offset = 0;
+        id_t sentinel = n_written;
+        loose_quadtree::flat_write(os, &h, sizeof(h), offset, h.nodes_offset);
+        loose_quadtree::flat_write(os, top_nodes.data(), n_top * sizeof(node_t), offset, offset + n_top * sizeof(node_t));
+        if (!append_file(os, temp_path("nodes"), offset, h.node_bbs_offset)) return false;
+        loose_quadtree::flat_write(os, top_bbs.data(), n_top * sizeof(aabb_t), offset, offset + n_top * sizeof(aabb_t));
+        if (!append_file(os, temp_path("node_bbs"), offset, h.node_points_begin_offset)) return false;
+        loose_quadtree::flat_write(os, top_points_begin.data(), n_top * sizeof(id_t), offset, offset + n_top * sizeof(id_t));
+        if (!append_file(os, temp_path("node_points_begin"), offset, offset)) return false;
+        loose_quadtree::flat_write(os, &sentinel, sizeof(sentinel), offset, h.entry_bbs_offset);
+        if (!append_file(os, temp_path("entry_bbs"), offset, h.payloads_offset)) return false;
+        if (!append_file(os, temp_path("payloads"), offset, h.size)) return false;
+
+        return bool(os) || fail("cannot write the output stream");
+    }
+
+    // why add or finish failed, empty while nothing did. after a failure finish returns false
+    std::string const& error() const { return failure; }
+
+private:
+    // the buckets' trees store the payloads (or input indices) directly
+    using sub_tree_t = loose_quadtree_t<payload_t, MAX_DEPTH, D, S>;
+    using node_t = typename sub_tree_t::node_t;
+
+    std::string temp_path(std::string const& name) const {
+        return (opts.temp_dir / (prefix + name)).string();
+    }
+
+    std::string bucket_path(uint64_t b) const { return temp_path("bucket_" + std::to_string(b)); }
+
+    // records the first failure, with the reason the system gave if there is one
+    bool fail(std::string const& what) {
+        if (failure.empty()) failure = (0 != errno) ? what + ": " + std::strerror(errno) : what;
+        return false;
+    }
+
+    // morton code of the bucket cell that contains the center of bb, bit d of each
+    // group of D bits selects the upper half along axis d, matching the child order
+    uint64_t bucket_of(aabb_t const& bb) const {
+        uint64_t code = 0;
+        aabb_t cell = opts.bounds;
+        for (uint32_t l=0; l<opts.bucket_depth; l++) {
+            uint64_t child = 0;
+            for (uint32_t d=0; d<D; d++) {
+                S center = scalar_traits_t::mid(bb.min[d], bb.max[d]);
+                S mid = scalar_traits_t::mid(cell.min[d], cell.max[d]);
+                if (center < mid) {
+                    cell.max[d] = mid;
+                } else {
+                    cell.min[d] = mid;
+                    child |= uint64_t(1) << d;
+                }
+            }
+            code = (code << D) | child;
+        }
+        return code;
+    }
+
+    static constexpr size_t record_size = sizeof(aabb_t) + sizeof(payload_t);
+
+    void add_one(aabb_t const& bb, payload_t const& data) {
+        uint64_t b = bucket_of(bb);
+        std::vector<char> &buf = bucket_buffers[b];
+        size_t at = buf.size();
+        buf.resize(at + record_size);
+        std::memcpy(buf.data() + at, &bb, sizeof(aabb_t));
+        std::memcpy(buf.data() + at + sizeof(aabb_t), &data, sizeof(payload_t));
+        bucket_counts[b]++;
+        n_boxes++;
+
+        buffered += record_size;
+        if (buffered > opts.buffer_bytes) spill();
+    }
+
+    // appends every buffered bucket to its file, one file open at a time
+    void spill() {
+        for (uint64_t b=0; b<bucket_buffers.size(); b++) {
+            if (!bucket_buffers[b].empty()) spill_bucket(b);
+        }
+        buffered = 0;
+    }
+
+    void spill_bucket(uint64_t b) {
+        std::vector<char> &buf = bucket_buffers[b];
+        if (failure.empty()) {
+            errno = 0;
+            std::ofstream out(bucket_path(b), std::ios::binary | std::ios::app);
+            out.write(buf.data(), buf.size());
+            out.close();
+            if (!out) fail("cannot write the bucket file " + bucket_path(b));
+            bucket_spilled[b] = 1;
+        }
+        std::vector<char>().swap(buf);
+    }
+
+    // the boxes of bucket b, from its file if it was spilled and from its buffer
+    bool read_bucket(uint64_t b, std::vector<aabb_t> &bbs, std::vector<payload_t> &payloads) {
+        std::vector<char> &buf = bucket_buffers[b];
+        if (bucket_spilled[b]) {
+            spill_bucket(b);
+            if (!failure.empty()) return false;
+
+            errno = 0;
+            std::string path = bucket_path(b);
+            std::ifstream in(path, std::ios::binary);
+            buf.resize(bucket_counts[b] * record_size);
+            in.read(buf.data(), buf.size());
+            if (!in) return fail("cannot read the bucket file " + path);
+            in.close();
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+            bucket_spilled[b] = 0;
+        }
+        assert(buf.size() == bucket_counts[b] * record_size);
+
+        bbs.resize(bucket_counts[b]);
+        payloads.resize(bucket_counts[b]);
+        for (uint64_t i=0; i<bucket_counts[b]; i++) {
+            std::memcpy(&bbs[i], buf.data() + i * record_size, sizeof(aabb_t));
+            std::memcpy(&payloads[i], buf.data() + i * record_size + sizeof(aabb_t), sizeof(payload_t));
+        }
+        std::vector<char>().swap(buf);
+        return true;
+    }
+
+    // copies a temporary file to os and pads up to end
+    bool append_file(std::ostream &os, std::string const& path, uint64_t &offset, uint64_t end) {
+        errno = 0;
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return fail("cannot read the temporary file " + path);
+
+        std::vector<char> buf(1 << 20);
+        while (in.read(buf.data(), buf.size()) || in.gcount() > 0) {
+            uint64_t n = in.gcount();
+            loose_quadtree::flat_write(os, buf.data(), n, offset, offset + n);
+        }
+        loose_quadtree::flat_write(os, nullptr, 0, offset, end);
+
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return bool(os) || fail("cannot write the output stream");
+    }
+
+    // number of boxes in the buckets below the cell (level, cell_prefix)
+    uint64_t count_below(uint32_t level, uint64_t cell_prefix) const {
+        uint32_t shift = D * (opts.bucket_depth - level);
+        uint64_t n = 0;
+        for (uint64_t b = cell_prefix << shift; b < (cell_prefix + 1) << shift; b++) n += bucket_counts[b];
+        return n;
+    }
+
+    uint64_t number_top(uint32_t level, uint64_t cell_prefix, uint64_t next_id) {
+        top_ids[level][cell_prefix] = next_id++;
+        if (level + 1 == opts.bucket_depth) return next_id;
+
+        for (uint64_t c=0; c<n_children; c++) {
+            uint64_t child_prefix = (cell_prefix << D) | c;
+            if (count_below(level + 1, child_prefix) > 0) next_id = number_top(level + 1, child_prefix, next_id);
+        }
+        return next_id;
+    }
+
+    // links the top-level nodes and fits their boxes bottom-up, returns the node (or bucket root)
+    id_t fill_top(uint32_t level, uint64_t cell_prefix) {
+        if (level == opts.bucket_depth) return bucket_roots[cell_prefix];
+        if (0 == count_below(level, cell_prefix)) return empty;
+
+        id_t nid = top_ids[level][cell_prefix];
+        aabb_t bb = sub_tree_t::empty_bb();
+        bool first = true;
+        for (uint64_t c=0; c<n_children; c++) {
+            uint64_t child_prefix = (cell_prefix << D) | c;
+            id_t child = fill_top(level + 1, child_prefix);
+            top_nodes[nid].child[c] = child;
+            if (empty == child) continue;
+
+            bb.extend(child < top_bbs.size() ? top_bbs[child] : bucket_bbs[child_prefix]);
+            if (first) {
+                top_points_begin[nid] = child < top_points_begin.size() ? top_points_begin[child] : bucket_begins[child_prefix];
+                first = false;
+            }
+        }
+        top_bbs[nid] = bb;
+        return nid;
+    }
+
+    options_t opts;
+    std::string prefix;
+    uint64_t n_boxes = 0;
+    uint64_t buffered = 0; // bytes in bucket_buffers
+    std::string failure;
+
+    // per-bucket data
+    std::vector<std::vector<char>> bucket_buffers; // records not yet appended to the bucket's file
+    std::vector<uint8_t> bucket_spilled;           // the bucket's file exists
+    std::vector<uint64_t> bucket_counts;
+    std::vector<id_t> bucket_roots;
+    std::vector<aabb_t> bucket_bbs;
+    std::vector<id_t> bucket_begins;
+
+    // top-level nodes above the buckets
+    std::vector<std::vector<id_t>> top_ids;
+    std::vector<node_t> top_nodes;
+    std::vector<aabb_t> top_bbs;
+    std::vector<id_t> top_points_begin;
+};
+
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef ALH_LOOSE_QUADTREE_SNAPSHOT_HPP
+#define ALH_LOOSE_QUADTREE_SNAPSHOT_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <utility>
+
+#include "loose_quadtree.hpp"
+
+namespace alh {
+
+// double-buffered tree for readers on other threads. build() fills the back buffer and publishes
+// it with one atomic store, readers pin the published tree through their own slot without taking
+// locks. every pin records the epoch it started in, and a buffer is only rebuilt once no reader
+// that started before it was retired is still pinned. only one thread may call build()
+template<typename TREE, uint32_t MAX_READERS=64>
+struct loose_quadtree_snapshot_t {
+
+    using tree_t = TREE;
+
+    explicit loose_quadtree_snapshot_t(typename tree_t::allocator_type const& alloc = {})
+        : buffers{tree_t(alloc), tree_t(alloc)} {}
+
+    loose_quadtree_snapshot_t(loose_quadtree_snapshot_t const&) = delete;
+    loose_quadtree_snapshot_t &operator=(loose_quadtree_snapshot_t const&) = delete;
+
+    // a pinned tree, valid until the pin is destroyed
+    struct pin_t {
+        pin_t(pin_t const&) = delete;
+        pin_t &operator=(pin_t const&) = delete;
+        ~pin_t() { slot.store(idle, std::memory_order_release); }
+
+        explicit operator bool() const { return nullptr != tree; }
+        tree_t const& operator*() const { assert(tree); return *tree; }
+        tree_t const* operator->() const { assert(tree); return tree; }
+
+    private:
+        friend struct loose_quadtree_snapshot_t;
+        pin_t(std::atomic<uint64_t> &slot, tree_t const* tree) : slot(slot), tree(tree) {}
+
+        std::atomic<uint64_t> &slot;
+        tree_t const* tree;
+    };
+
+    // one per reader thread, owns a slot until it is destroyed
+    struct reader_t {
+        reader_t(reader_t const&) = delete;
+        reader_t &operator=(reader_t const&) = delete;
+        ~reader_t() { owner.slots[id].used.store(false, std::memory_order_release); }
+
+        // the tree is empty (operator bool is false) until the first build has been published
+        pin_t pin() {
+            auto &slot = owner.slots[id].epoch;
+            assert(idle == slot.load(std::memory_order_relaxed) && "one pin per reader at a time");
+
+            // seq_cst orders the slot store before loading the tree, see publish
+            slot.store(owner.epoch.load());
+            return pin_t(slot, owner.current.load());
+        }
+
+    private:
+        friend struct loose_quadtree_snapshot_t;
+        reader_t(loose_quadtree_snapshot_t &owner, uint32_t id) : owner(owner), id(id) {}
+
+        loose_quadtree_snapshot_t &owner;
+        uint32_t id;
+    };
+
+    // claims a free reader slot, at most MAX_READERS readers can exist at once
+    reader_t register_reader() {
+        for (uint32_t i=0; i<MAX_READERS; i++) {
+            bool expected = false;
+            if (slots[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire)) return reader_t(*this, i);
+        }
+        assert(false && "out of reader slots, raise MAX_READERS");
+        std::abort();
+    }
+
+    // forwards to tree_t::build on the back buffer and publishes it, waits first for readers
+    // that may still hold the back buffer from before it was retired
+    template<typename... Args>
+    void build(Args&&... args) {
+        uint32_t back = 1 - front;
+        wait_for_readers(retired[back]);
+
+        buffers[back].build(std::forward<Args>(args)...);
+        publish(back);
+    }
+
+    // the tree that readers currently see, for the writer thread
+    tree_t const* published() const { return current.load(); }
+
+private:
+    static constexpr uint64_t idle = 0;
+
+    // readers that loaded epoch <= e may hold the tree retired at e. a reader that loads the new
+    // epoch also sees the new tree, a reader whose slot store comes after the writer has checked
+    // it loads the tree after it was stored, so only slots <= e can refer to the old tree
+    void publish(uint32_t back) {
+        current.store(&buffers[back]);
+        retired[front] = epoch.fetch_add(1);
+        front = back;
+    }
+
+    void wait_for_readers(uint64_t retired_epoch) {
+        for (auto &slot : slots) {
+            for (;;) {
+                uint64_t e = slot.epoch.load();
+                if (idle == e || e > retired_epoch) break;
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    struct alignas(64) slot_t {
+        std::atomic<uint64_t> epoch = idle;
+        std::atomic<bool> used = false;
+    };
+
+    tree_t buffers[2];
+    uint32_t front = 1;
+    uint64_t retired[2] = {0, 0};
+
+    std::atomic<tree_t const*> current = nullptr;
+    std::atomic<uint64_t> epoch = 1;
+    slot_t slots[MAX_READERS];
+};
+
+};
+
+#endif
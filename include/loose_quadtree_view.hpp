@@ -0,0 +1,134 @@
+#ifndef ALH_LOOSE_QUADTREE_VIEW_HPP
+#define ALH_LOOSE_QUADTREE_VIEW_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "loose_quadtree.hpp"
+
+#if __has_include(<sys/mman.h>)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define ALH_LOOSE_QUADTREE_HAS_MMAP
+#endif
+
+namespace alh {
+
+// read-only tree over a buffer in the flat format written by loose_quadtree_t::serialize.
+// the buffer is queried in place, nothing is copied, so it must outlive the view and be aligned
+// to loose_quadtree::flat_alignment (memory maps and page-aligned allocations are)
+template<typename T=void*, uint32_t D=2, typename S=float>
+struct loose_quadtree_view_t {
+
+    using id_t = uint64_t;
+    using payload_t = std::conditional_t<std::is_void_v<T>, id_t, T>;
+    using aabb_t = typename loose_quadtree::basic_aabb_t<D, S>;
+    using flat_header_t = typename loose_quadtree::flat_header_t;
+
+    static constexpr id_t empty = id_t(-1);
+    static constexpr uint32_t n_children = 1u << D;
+
+    // leaves the view empty (operator bool is false) if the buffer is too short or was written
+    // for a different version, dimension, coordinate type or payload size
+    loose_quadtree_view_t(void const* data, size_t size) {
+        auto const* base = static_cast<std::byte const*>(data);
+        if (size < sizeof(flat_header_t)) return;
+        assert(0 == reinterpret_cast<uintptr_t>(base) % alignof(flat_header_t));
+
+        auto const* h = reinterpret_cast<flat_header_t const*>(base);
+        auto expected = loose_quadtree::make_flat_header<D, S, payload_t>(h->root, h->n_nodes, h->n_boxes);
+        if (0 != std::memcmp(h, &expected, sizeof(flat_header_t)) || expected.size > size) return;
+        if (empty != h->root && h->root >= h->n_nodes) return;
+
+        nodes = reinterpret_cast<node_t const*>(base + h->nodes_offset);
+        node_bbs = reinterpret_cast<aabb_t const*>(base + h->node_bbs_offset);
+        node_points_begin = reinterpret_cast<id_t const*>(base + h->node_points_begin_offset);
+        entry_bbs = reinterpret_cast<aabb_t const*>(base + h->entry_bbs_offset);
+        payloads = reinterpret_cast<payload_t const*>(base + h->payloads_offset);
+        header = h;
+    }
+
+    explicit operator bool() const { return nullptr != header; }
+
+    size_t size() const { return header ? header->n_boxes : 0; }
+
+    // calls fn(payload) for every entry intersecting query_bb
+    template<typename F>
+    void query(aabb_t const& query_bb, F &&fn) const {
+        assert(header);
+        if (empty != header->root) query_recursive(query_bb, header->root, fn);
+    }
+
+private:
+    struct node_t {
+        id_t child[n_children];
+    };
+
+    template<typename F>
+    void query_recursive(aabb_t const& query_bb, id_t nid, F &fn) const {
+        if (query_bb.intersect(node_bbs[nid])) {
+
+            bool is_not_leaf = false;
+            for (id_t child : nodes[nid].child) {
+                if (empty != child && (is_not_leaf=true)) query_recursive(query_bb, child, fn);
+            }
+
+            if (!is_not_leaf) {
+                id_t i_front = node_points_begin[nid];
+                id_t i_back = node_points_begin[nid+1];
+                for (id_t i=i_front; i!=i_back; i++) {
+                    if (query_bb.intersect(entry_bbs[i])) fn(payloads[i]);
+                }
+            }
+        }
+    }
+
+    flat_header_t const* header = nullptr;
+    node_t const* nodes = nullptr;
+    aabb_t const* node_bbs = nullptr;
+    id_t const* node_points_begin = nullptr;
+    aabb_t const* entry_bbs = nullptr;
+    payload_t const* payloads = nullptr;
+};
+
+#if defined(ALH_LOOSE_QUADTREE_HAS_MMAP)
+// read-only memory map of a whole file, operator bool is false if it could not be mapped
+struct mapped_file_t {
+    explicit mapped_file_t(char const* path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (0 == fstat(fd, &st) && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (MAP_FAILED != p) {
+                ptr = p;
+                len = st.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    ~mapped_file_t() { if (ptr) munmap(ptr, len); }
+
+    mapped_file_t(mapped_file_t const&) = delete;
+    mapped_file_t &operator=(mapped_file_t const&) = delete;
+
+    explicit operator bool() const { return nullptr != ptr; }
+
+    void const* data() const { return ptr; }
+    size_t size() const { return len; }
+
+private:
+    void *ptr = nullptr;
+    size_t len = 0;
+};
+#endif
+
+};
+
+#endif
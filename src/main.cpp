@@ -14,7 +14,7 @@
 #include "loose_quadtree.hpp"
 
 Texture2D g_16x16icons_tex;
-alh::loose_quadtree_t<alh::loose_quadtree::aabb_t> g_qt;
+alh::loose_quadtree_t<void> g_qt;
 std::vector<alh::loose_quadtree::aabb_t> g_rects;
 
 void draw_items(std::vector<alh::loose_quadtree::aabb_t> const& rects) {
@@ -55,7 +55,7 @@ void update_draw_frame() {
 
     // draw query results
     for (auto it = g_qt.query_start(offset_bb); it != g_qt.query_end(); ++it) {
-        auto bb = *it;
+        auto bb = g_rects[*it];
         DrawRectangleLines(bb.min.x,
                            bb.min.y,
                            bb.max.x - bb.min.x,
@@ -104,7 +104,7 @@ int main(int argc, char **argv) {
     }
 
     // create quadtree
-    g_qt.build(g_rects, g_rects);
+    g_qt.build(g_rects);
 
 #if defined(PLATFORM_WEB)
     emscripten_set_main_loop(update_draw_frame, 0, 1);
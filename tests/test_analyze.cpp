@@ -0,0 +1,108 @@
+// invariants of the tree quality report and the memory accounting
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "rand.hpp"
+#include "test_util.hpp"
+#include "loose_quadtree.hpp"
+
+using namespace alh::test;
+using aabb_t = alh::loose_quadtree::aabb_t;
+using build_options_t = alh::loose_quadtree::build_options_t;
+using split_policy_t = alh::loose_quadtree::split_policy_t;
+
+static build_options_t make_options(uint32_t variant) {
+    build_options_t opts;
+    opts.split_policy = (variant & 1) ? split_policy_t::centers : split_policy_t::midpoint;
+    opts.compress_paths = variant & 2;
+    opts.leaf_size = (variant & 4) ? 8 : 1;
+    return opts;
+}
+
+TEST_CASE("analyze counts every node, leaf and entry", "[analyze]") {
+    auto rng = alh::rand_f32();
+    rng.seed(39);
+
+    std::vector<aabb_t> boxes;
+    for (int i=0; i<5000; i++) {
+        float x = rng.get_normalish(0.f, 1000.f), y = rng.get_uniform(0.f, 1000.f), s = rng.get_uniform(0.f, 30.f);
+        boxes.push_back({{x, y}, {x + s, y + s}});
+    }
+
+    for (uint32_t variant=0; variant<8; variant++) {
+        alh::loose_quadtree_t<void, 8> tree(boxes, make_options(variant));
+        auto report = tree.analyze({1e9f, 1e9f});
+
+        CAPTURE(variant);
+        REQUIRE(boxes.size() == report.n_entries);
+        REQUIRE(report.n_nodes == std::accumulate(report.nodes_per_depth.begin(), report.nodes_per_depth.end(), uint64_t(0)));
+        REQUIRE(report.n_leaves == std::accumulate(report.leaves_per_depth.begin(), report.leaves_per_depth.end(), uint64_t(0)));
+        REQUIRE(report.n_leaves == std::accumulate(report.leaf_size_log2.begin(), report.leaf_size_log2.end(), uint64_t(0)));
+        REQUIRE(1 == report.nodes_per_depth[0]);
+        REQUIRE(report.max_leaf_size >= report.mean_leaf_size);
+
+        // a query much larger than the tree enters every node and tests every entry
+        REQUIRE(std::abs(double(report.n_nodes) - report.expected_nodes_visited) < 0.5);
+        REQUIRE(std::abs(double(report.n_entries) - report.expected_entries_tested) < 0.5);
+
+        REQUIRE(report.mean_expansion >= 0.);
+        REQUIRE(report.max_expansion >= report.mean_expansion);
+        REQUIRE(report.sibling_overlap >= 0.);
+        REQUIRE(report.sibling_overlap <= 1.);
+    }
+}
+
+TEST_CASE("points never reach past their cells", "[analyze]") {
+    auto rng = alh::rand_f32();
+    rng.seed(40);
+
+    // a dense cluster far from two outliers, so path compression has long chains to skip
+    std::vector<aabb_t> points;
+    for (int i=0; i<2000; i++) {
+        float x = rng.get_uniform(10.f, 10.01f), y = rng.get_uniform(10.f, 10.01f);
+        points.push_back({{x, y}, {x, y}});
+    }
+    points.push_back({{0.f, 0.f}, {0.f, 0.f}});
+    points.push_back({{100.f, 100.f}, {100.f, 100.f}});
+
+    for (uint32_t variant=0; variant<8; variant++) {
+        build_options_t opts = make_options(variant);
+        opts.max_depth = 24;
+        alh::loose_quadtree_t<void> tree(points, opts);
+        auto report = tree.analyze();
+
+        CAPTURE(variant);
+        REQUIRE(0. == report.mean_expansion);
+        REQUIRE(0. == report.max_expansion);
+    }
+}
+
+TEST_CASE("memory_usage tracks slack and shrink_to_fit releases it", "[analyze][memory]") {
+    auto rng = alh::rand_f32();
+    rng.seed(41);
+
+    alh::loose_quadtree_t<void, 6> tree(random_boxes(rng, dataset_t::uniform, 20000));
+    auto large = tree.memory_usage();
+    REQUIRE(large.used() > 0);
+    REQUIRE(large.used() <= large.reserved());
+    REQUIRE(20000 * sizeof(uint64_t) == large.query_list.used);
+    REQUIRE(tree.analyze().n_nodes * sizeof(aabb_t) == large.node_bbs.used);
+    REQUIRE((tree.analyze().n_nodes + 1) * sizeof(uint64_t) == large.node_points_begin.used);
+
+    // a smaller rebuild keeps the capacity of the larger one
+    tree.build(random_boxes(rng, dataset_t::uniform, 100));
+    auto small = tree.memory_usage();
+    REQUIRE(small.used() < large.used());
+    REQUIRE(small.reserved() == large.reserved());
+    REQUIRE(small.slack() > 0);
+
+    tree.shrink_to_fit();
+    auto shrunk = tree.memory_usage();
+    REQUIRE(shrunk.used() == small.used());
+    REQUIRE(shrunk.reserved() < small.reserved());
+}
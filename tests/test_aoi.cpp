@@ -0,0 +1,140 @@
+// area-of-interest deltas against brute-force sets, over both tree kinds, as entities move
+// and subscribers come and go
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "rand.hpp"
+#include "test_util.hpp"
+#include "loose_quadtree.hpp"
+#include "loose_cell_quadtree.hpp"
+#include "loose_quadtree_aoi.hpp"
+
+namespace {
+
+using namespace alh::test;
+using aabb_t = alh::loose_quadtree::aabb_t;
+
+aabb_t random_region(alh::rand_f32 &rng) {
+    float s = rng.get_uniform(0.f, 1.f) < 0.1f ? rng.get_uniform(300.f, 1500.f) : rng.get_uniform(0.f, 120.f);
+    return make_box(rng.get_uniform(-200.f, 1000.f), rng.get_uniform(-200.f, 1000.f), s, s);
+}
+
+template<typename AOI>
+void check_deltas(AOI const& aoi, std::vector<uint64_t> const& subs, std::vector<std::vector<uint64_t>> &expected,
+                  std::vector<aabb_t> const& bbs) {
+    for (size_t k=0; k<subs.size(); k++) {
+        auto now = brute_force(bbs, aoi.region(subs[k]));
+        std::vector<uint64_t> entered, left;
+        std::set_difference(now.begin(), now.end(), expected[k].begin(), expected[k].end(), std::back_inserter(entered));
+        std::set_difference(expected[k].begin(), expected[k].end(), now.begin(), now.end(), std::back_inserter(left));
+
+        auto got_entered = aoi.entered(subs[k]), got_left = aoi.left(subs[k]), got_current = aoi.current(subs[k]);
+        CAPTURE(k);
+        REQUIRE(std::vector<uint64_t>(got_entered.begin(), got_entered.end()) == entered);
+        REQUIRE(std::vector<uint64_t>(got_left.begin(), got_left.end()) == left);
+        REQUIRE(std::vector<uint64_t>(got_current.begin(), got_current.end()) == now);
+        expected[k] = std::move(now);
+    }
+}
+
+void move_some(alh::rand_f32 &rng, std::vector<aabb_t> &bbs) {
+    for (aabb_t &bb : bbs) {
+        if (rng.get_uniform(0.f, 1.f) < 0.3f) {
+            float dx = rng.get_uniform(-15.f, 15.f), dy = rng.get_uniform(-15.f, 15.f);
+            bb.min.x += dx; bb.max.x += dx;
+            bb.min.y += dy; bb.max.y += dy;
+        }
+    }
+}
+
+}
+
+TEST_CASE("aoi deltas over a rebuilt tree match brute force", "[aoi]") {
+    auto rng = alh::rand_f32();
+    rng.seed(48);
+
+    std::vector<aabb_t> bbs;
+    for (int i=0; i<3000; i++) bbs.push_back(make_box(rng.get_uniform(0.f, 800.f), rng.get_uniform(0.f, 800.f),
+                                                       rng.get_uniform(0.f, 10.f), rng.get_uniform(0.f, 10.f)));
+
+    for (uint32_t threads : {1u, 4u}) {
+        using tree_t = alh::loose_quadtree_t<void, 8>;
+        tree_t tree{tree_t::allocator_type()};
+        alh::loose_quadtree_aoi_t<tree_t> aoi;
+
+        std::vector<uint64_t> subs;
+        std::vector<std::vector<uint64_t>> expected;
+        for (int i=0; i<300; i++) {
+            subs.push_back(aoi.subscribe(random_region(rng)));
+            expected.emplace_back();
+        }
+
+        for (int tick=0; tick<8; tick++) {
+            tree.build(bbs);
+            aoi.update(tree, threads);
+            CAPTURE(threads, tick);
+            check_deltas(aoi, subs, expected, bbs);
+
+            // some regions follow their owner around, some subscribers leave and new ones join
+            for (size_t k=0; k<subs.size(); k+=7) {
+                aabb_t r = aoi.region(subs[k]);
+                r.min.x += 20.f; r.max.x += 20.f;
+                aoi.set_region(subs[k], r);
+            }
+            for (size_t k=tick; k<subs.size(); k+=41) {
+                aoi.unsubscribe(subs[k]);
+                subs[k] = aoi.subscribe(random_region(rng));
+                expected[k].clear();
+            }
+            move_some(rng, bbs);
+        }
+        REQUIRE(aoi.size() == subs.size());
+    }
+}
+
+TEST_CASE("aoi deltas over loose cells match brute force", "[aoi][cells]") {
+    auto rng = alh::rand_f32();
+    rng.seed(480);
+
+    using tree_t = alh::loose_cell_quadtree_t<void, 7>;
+    tree_t tree(make_box(0.f, 0.f, 1000.f, 1000.f));
+
+    // cell ids are handed out in insertion order, so they match the indices here
+    std::vector<aabb_t> bbs;
+    for (int i=0; i<2000; i++) {
+        bbs.push_back(make_box(rng.get_uniform(0.f, 900.f), rng.get_uniform(0.f, 900.f), rng.get_uniform(0.f, 20.f), 5.f));
+        REQUIRE(tree.insert(bbs.back()) == uint64_t(i));
+    }
+
+    alh::loose_quadtree_aoi_t<tree_t> aoi;
+    std::vector<uint64_t> subs;
+    std::vector<std::vector<uint64_t>> expected;
+    for (int i=0; i<500; i++) {
+        subs.push_back(aoi.subscribe(random_region(rng)));
+        expected.emplace_back();
+    }
+
+    for (int tick=0; tick<8; tick++) {
+        aoi.update(tree, 3);
+        CAPTURE(tick);
+        check_deltas(aoi, subs, expected, bbs);
+
+        move_some(rng, bbs);
+        for (uint64_t i=0; i<bbs.size(); i++) tree.move(i, bbs[i]);
+    }
+
+    aoi.update(tree, 3);
+    check_deltas(aoi, subs, expected, bbs);
+
+    // a tick without movement has nothing entering or leaving
+    aoi.update(tree, 3);
+    for (uint64_t sub : subs) {
+        REQUIRE(aoi.entered(sub).empty());
+        REQUIRE(aoi.left(sub).empty());
+    }
+}
@@ -0,0 +1,284 @@
+// loose_cell_quadtree_t against a brute-force scan of the live entries, through inserts,
+// moves and removes, batched and staged from several threads
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "rand.hpp"
+#include "test_util.hpp"
+#include "loose_cell_quadtree.hpp"
+
+namespace {
+
+using namespace alh::test;
+using aabb_t = alh::loose_quadtree::aabb_t;
+
+template<typename TREE>
+void check_queries(alh::rand_f32 &rng, TREE const& tree, std::vector<aabb_t> const& live_bbs, std::vector<uint64_t> const& live_ids) {
+    for (int i=0; i<50; i++) {
+        float x = rng.get_uniform(-1500.f, 2500.f), y = rng.get_uniform(-1500.f, 2500.f);
+        float s = (i % 3 == 0) ? 0.f : rng.get_uniform(0.f, (i % 3 == 1) ? 20.f : 600.f);
+        aabb_t q = make_box(x, y, s, s);
+
+        std::vector<uint64_t> expected, got;
+        for (size_t j=0; j<live_ids.size(); j++) {
+            if (q.intersect(live_bbs[j])) expected.push_back(live_ids[j]);
+        }
+        tree.query(q, [&](uint64_t id) { got.push_back(id); });
+
+        std::sort(expected.begin(), expected.end());
+        std::sort(got.begin(), got.end());
+        CAPTURE(q.min.x, q.min.y, q.max.x, q.max.y);
+        REQUIRE(got == expected);
+    }
+}
+
+}
+
+TEST_CASE("loose cells match brute force through inserts, moves and removes", "[cells]") {
+    auto rng = alh::rand_f32();
+    rng.seed(41);
+
+    for (float looseness : {1.25f, 2.f, 4.f}) {
+        alh::loose_cell_quadtree_t<void, 7>::options_t opts;
+        opts.looseness = looseness;
+        alh::loose_cell_quadtree_t<void, 7> tree(make_box(0.f, 0.f, 1000.f, 1000.f), opts);
+
+        // id -> box of the live entries, the reference
+        std::vector<aabb_t> bbs;
+        std::vector<bool> live;
+        auto live_set = [&](std::vector<aabb_t> &live_bbs, std::vector<uint64_t> &live_ids) {
+            live_bbs.clear();
+            live_ids.clear();
+            for (uint64_t id=0; id<bbs.size(); id++) {
+                if (live[id]) { live_bbs.push_back(bbs[id]); live_ids.push_back(id); }
+            }
+        };
+
+        std::vector<aabb_t> live_bbs;
+        std::vector<uint64_t> live_ids;
+        for (int round=0; round<20; round++) {
+            for (int i=0; i<300; i++) {
+                aabb_t bb = random_box(rng, dataset_t::scattered);
+                uint64_t id = tree.insert(bb);
+                if (id >= bbs.size()) { bbs.resize(id + 1); live.resize(id + 1, false); }
+                REQUIRE(!live[id]);
+                bbs[id] = bb;
+                live[id] = true;
+            }
+
+            live_set(live_bbs, live_ids);
+            for (uint64_t id : live_ids) {
+                float u = rng.get_uniform(0.f, 1.f);
+                if (u < 0.2f) {
+                    tree.remove(id);
+                    live[id] = false;
+                } else if (u < 0.5f) {
+                    // small steps mostly stay in their cell, some jump across the world
+                    aabb_t bb = bbs[id];
+                    float dx = (u < 0.45f) ? rng.get_uniform(-2.f, 2.f) : rng.get_uniform(-900.f, 900.f);
+                    bb.min.x += dx;
+                    bb.max.x += dx;
+                    tree.move(id, bb);
+                    bbs[id] = bb;
+                }
+            }
+
+            live_set(live_bbs, live_ids);
+            CAPTURE(looseness, round);
+            REQUIRE(live_ids.size() == tree.size());
+            check_queries(rng, tree, live_bbs, live_ids);
+        }
+
+        tree.clear();
+        REQUIRE(0 == tree.size());
+        bool any = false;
+        tree.query(make_box(-1e6f, -1e6f, 2e6f, 2e6f), [&](uint64_t) { any = true; });
+        REQUIRE(!any);
+    }
+}
+
+TEST_CASE("fat boxes absorb small moves and stay exact", "[cells]") {
+    auto rng = alh::rand_f32();
+    rng.seed(43);
+
+    using tree_t = alh::loose_cell_quadtree_t<void, 7>;
+    tree_t::options_t opts;
+    opts.margin = 1.f;
+    opts.velocity_margin = 4.f;
+    tree_t tree(make_box(0.f, 0.f, 1000.f, 1000.f), opts);
+
+    std::vector<aabb_t> bbs;
+    std::vector<uint64_t> ids;
+    std::vector<float> vx, vy;
+    for (uint64_t i=0; i<2000; i++) {
+        bbs.push_back(random_box(rng, dataset_t::scattered));
+        REQUIRE(i == tree.insert(bbs.back()));
+        ids.push_back(i);
+        vx.push_back(rng.get_uniform(-1.f, 1.f));
+        vy.push_back(rng.get_uniform(-1.f, 1.f));
+    }
+
+    // constant velocities, after the first refit the velocity margin covers a few ticks
+    for (int tick=0; tick<30; tick++) {
+        for (uint64_t i=0; i<bbs.size(); i++) {
+            bbs[i].min.x += vx[i]; bbs[i].max.x += vx[i];
+            bbs[i].min.y += vy[i]; bbs[i].max.y += vy[i];
+            tree.move(i, bbs[i]);
+        }
+        CAPTURE(tick);
+        check_queries(rng, tree, bbs, ids);
+    }
+
+    auto const& stats = tree.update_stats();
+    REQUIRE(30 * bbs.size() == stats.moves);
+    REQUIRE(stats.skipped > stats.moves / 2);
+    REQUIRE(stats.relinked <= stats.moves - stats.skipped);
+
+    tree.reset_update_stats();
+    REQUIRE(0 == tree.update_stats().moves);
+}
+
+TEST_CASE("loose cells keep payloads with their entries", "[cells]") {
+    auto rng = alh::rand_f32();
+    rng.seed(42);
+
+    alh::loose_cell_quadtree_t<int, 6> tree(make_box(0.f, 0.f, 1000.f, 1000.f));
+    std::vector<uint64_t> ids;
+    for (int i=0; i<1000; i++) ids.push_back(tree.insert(random_box(rng, dataset_t::scattered), i));
+    for (int i=0; i<1000; i+=2) tree.remove(ids[i]);
+    for (int i=1; i<1000; i+=2) tree.move(ids[i], random_box(rng, dataset_t::scattered));
+
+    for (int i=1; i<1000; i+=2) REQUIRE(i == tree.data(ids[i]));
+
+    std::vector<int> all;
+    tree.query(make_box(-1e6f, -1e6f, 2e6f, 2e6f), [&](int v) { all.push_back(v); });
+    std::sort(all.begin(), all.end());
+    REQUIRE(500 == all.size());
+    for (int i=0; i<500; i++) REQUIRE(2*i + 1 == all[i]);
+}
+
+TEST_CASE("batched updates match one-by-one updates", "[cells]") {
+    auto rng = alh::rand_f32();
+    rng.seed(44);
+
+    using tree_t = alh::loose_cell_quadtree_t<int, 7>;
+    tree_t::options_t opts;
+    opts.margin = 0.5f;
+    opts.velocity_margin = 2.f;
+
+    for (uint32_t threads : {1u, 4u}) {
+        tree_t tree(make_box(0.f, 0.f, 1000.f, 1000.f), opts);
+        tree_t::update_batch_t batch;
+
+        // payload -> box of the live entries, payloads are unique
+        std::vector<aabb_t> bbs;
+        std::vector<uint64_t> id_of;
+        std::vector<bool> live;
+        int next_payload = 0;
+
+        for (int tick=0; tick<12; tick++) {
+            for (int i=0; i<(tick == 0 ? 40000 : 2000); i++) {
+                bbs.push_back(random_box(rng, dataset_t::scattered));
+                live.push_back(true);
+                batch.insert(bbs.back(), next_payload++);
+            }
+            for (size_t p=0; p<id_of.size(); p++) {
+                if (!live[p]) continue;
+                float u = rng.get_uniform(0.f, 1.f);
+                if (u < 0.05f) {
+                    batch.remove(id_of[p]);
+                    live[p] = false;
+                } else if (u < 0.9f) {
+                    float dx = (u < 0.85f) ? rng.get_uniform(-1.f, 1.f) : rng.get_uniform(-500.f, 500.f);
+                    bbs[p].min.x += dx;
+                    bbs[p].max.x += dx;
+                    batch.move(id_of[p], bbs[p]);
+                }
+            }
+
+            size_t n_inserts = bbs.size() - id_of.size();
+            tree.apply(batch, threads);
+            REQUIRE(0 == batch.size());
+            REQUIRE(n_inserts == batch.inserted().size());
+            id_of.insert(id_of.end(), batch.inserted().begin(), batch.inserted().end());
+
+            std::vector<aabb_t> live_bbs;
+            std::vector<uint64_t> live_payloads;
+            for (size_t p=0; p<bbs.size(); p++) {
+                if (live[p]) {
+                    live_bbs.push_back(bbs[p]);
+                    live_payloads.push_back(p);
+                    REQUIRE(int(p) == tree.data(id_of[p]));
+                }
+            }
+            CAPTURE(threads, tick);
+            REQUIRE(live_payloads.size() == tree.size());
+            check_queries(rng, tree, live_bbs, live_payloads);
+        }
+        REQUIRE(tree.update_stats().skipped > 0);
+        REQUIRE(tree.update_stats().relinked > 0);
+    }
+}
+
+TEST_CASE("staged inserts from many threads match brute force", "[cells][concurrent]") {
+    using tree_t = alh::loose_cell_quadtree_t<int, 7>;
+
+    for (uint32_t threads : {1u, 4u}) {
+        tree_t tree(make_box(0.f, 0.f, 1000.f, 1000.f));
+        tree_t::insert_stage_t stage(tree, 8);
+
+        // payload -> box, producer p queues payloads p, p + 8, p + 16...
+        std::vector<aabb_t> bbs;
+        std::vector<uint64_t> id_of;
+
+        for (int round=0; round<3; round++) {
+            size_t first = bbs.size();
+            std::vector<std::vector<aabb_t>> per_lane(stage.n_lanes());
+            auto rng = alh::rand_f32();
+            rng.seed(45 + round);
+            for (int i=0; i<8 * 5000; i++) {
+                bbs.push_back(random_box(rng, dataset_t::scattered));
+                per_lane[i % 8].push_back(bbs.back());
+            }
+
+            std::vector<std::thread> producers;
+            for (uint32_t p=0; p<stage.n_lanes(); p++) {
+                producers.emplace_back([&, p] {
+                    for (size_t j=0; j<per_lane[p].size(); j++) stage.lane(p).insert(per_lane[p][j], int(first + j*8 + p));
+                });
+            }
+            for (auto &t : producers) t.join();
+
+            // nothing is visible before the sync point
+            size_t before = tree.size();
+            tree.query(make_box(-1e6f, -1e6f, 2e6f, 2e6f), [&](int) { before--; });
+            REQUIRE(0 == before);
+
+            tree.apply(stage, threads);
+            id_of.resize(bbs.size());
+            for (uint32_t p=0; p<stage.n_lanes(); p++) {
+                REQUIRE(0 == stage.lane(p).size());
+                REQUIRE(per_lane[p].size() == stage.lane(p).inserted().size());
+                for (size_t j=0; j<per_lane[p].size(); j++) id_of[first + j*8 + p] = stage.lane(p).inserted()[j];
+            }
+
+            std::vector<uint64_t> payloads;
+            for (size_t i=0; i<bbs.size(); i++) {
+                REQUIRE(int(i) == tree.data(id_of[i]));
+                payloads.push_back(i);
+            }
+            CAPTURE(threads, round);
+            REQUIRE(bbs.size() == tree.size());
+            check_queries(rng, tree, bbs, payloads);
+
+            // the stage mixes with the other update paths
+            tree.remove(id_of[first]);
+            id_of[first] = tree.insert(bbs[first], int(first));
+        }
+    }
+}
@@ -0,0 +1,909 @@
+// cross-checks every query path against a brute-force scan of the input boxes
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <ranges>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rand.hpp"
+#include "test_util.hpp"
+#include "loose_quadtree.hpp"
+#include "loose_quadtree_view.hpp"
+#include "loose_quadtree_external.hpp"
+
+#if __has_include(<sys/resource.h>)
+    #include <sys/resource.h>
+#endif
+
+namespace {
+
+using namespace alh::test;
+using build_options_t = alh::loose_quadtree::build_options_t;
+using split_policy_t = alh::loose_quadtree::split_policy_t;
+
+template<typename TREE>
+std::vector<uint64_t> by_query_start(TREE &tree, typename TREE::aabb_t const& q) {
+    std::vector<uint64_t> out;
+    for (auto it = tree.query_start(q); it != tree.query_end(); ++it) out.push_back(*it);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+// holds a serialized tree at the alignment loose_quadtree_view_t expects
+struct flat_buffer_t {
+    struct alignas(alh::loose_quadtree::flat_alignment) block_t { std::byte b[alh::loose_quadtree::flat_alignment]; };
+
+    explicit flat_buffer_t(std::string const& bytes) : blocks(bytes.size() / sizeof(block_t) + 1), size(bytes.size()) {
+        std::memcpy(blocks.data(), bytes.data(), bytes.size());
+    }
+
+    std::vector<block_t> blocks;
+    size_t size;
+};
+
+template<typename VIEW>
+std::vector<uint64_t> by_view(VIEW const& view, typename VIEW::aabb_t const& q) {
+    std::vector<uint64_t> out;
+    view.query(q, [&](uint64_t i) { out.push_back(i); });
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+build_options_t make_options(uint32_t leaf_size, split_policy_t split, uint32_t threads, bool compress, uint32_t max_depth) {
+    build_options_t opts;
+    opts.leaf_size = leaf_size;
+    opts.split_policy = split;
+    opts.threads = threads;
+    opts.compress_paths = compress;
+    opts.max_depth = max_depth;
+    return opts;
+}
+
+std::vector<build_options_t> all_options() {
+    return {
+        {},
+        make_options(8, split_policy_t::midpoint, 1, false, build_options_t::template_depth),
+        make_options(1, split_policy_t::centers, 1, false, build_options_t::template_depth),
+        make_options(4, split_policy_t::centers, 1, true, 16),
+        make_options(1, split_policy_t::midpoint, 1, true, 16),
+        make_options(2, split_policy_t::midpoint, 8, false, build_options_t::template_depth),
+        make_options(1, split_policy_t::centers, 4, true, 12),
+        make_options(1, split_policy_t::midpoint, 1, false, 0),
+    };
+}
+
+}
+
+TEST_CASE("query_start and query match brute force", "[query]") {
+    auto rng = alh::rand_f32();
+    rng.seed(37);
+
+    using tree_t = alh::loose_quadtree_t<void, 6>;
+    tree_t tree{tree_t::allocator_type()};
+    auto queries = random_queries<alh::loose_quadtree::aabb_t>(rng, 200);
+
+    for (dataset_t kind : all_datasets) {
+        for (size_t n : {1, 2, 17, 2000}) {
+            auto boxes = random_boxes<alh::loose_quadtree::aabb_t>(rng, kind, n);
+
+            for (build_options_t const& opts : all_options()) {
+                tree.build(boxes, opts);
+
+                for (auto const& q : queries) {
+                    auto expected = brute_force(boxes, q);
+                    CAPTURE(int(kind), n, opts.leaf_size, int(opts.split_policy), opts.threads, opts.compress_paths,
+                            opts.max_depth, q.min.x, q.min.y, q.max.x, q.max.y);
+                    REQUIRE(by_query_start(tree, q) == expected);
+                    REQUIRE(by_visitor(tree, q) == expected);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("payloads follow their boxes", "[query]") {
+    auto rng = alh::rand_f32();
+    rng.seed(38);
+
+    auto boxes = random_boxes<alh::loose_quadtree::aabb_t>(rng, dataset_t::mixed, 1000);
+    std::vector<uint32_t> payloads;
+    for (size_t i=0; i<boxes.size(); i++) payloads.push_back(uint32_t(i * 7 + 3));
+
+    alh::loose_quadtree_t<uint32_t, 5> tree(boxes, payloads);
+    for (auto const& q : random_queries<alh::loose_quadtree::aabb_t>(rng, 200)) {
+        std::vector<uint64_t> got;
+        for (auto it = tree.query_start(q); it != tree.query_end(); ++it) {
+            REQUIRE(3 == *it % 7);
+            got.push_back((*it - 3) / 7);
+        }
+        std::sort(got.begin(), got.end());
+        REQUIRE(got == brute_force(boxes, q));
+    }
+}
+
+TEST_CASE("every build overload keeps payloads with their boxes", "[query]") {
+    auto rng = alh::rand_f32();
+    rng.seed(31);
+
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    auto boxes = random_boxes<aabb_t>(rng, dataset_t::mixed, 1500);
+    auto queries = random_queries<aabb_t>(rng, 200);
+
+    SECTION("move-only payloads from an rvalue vector") {
+        std::vector<std::unique_ptr<int>> payloads;
+        for (size_t i=0; i<boxes.size(); i++) payloads.push_back(std::make_unique<int>(int(i)));
+
+        alh::loose_quadtree_t<std::unique_ptr<int>, 5> tree(boxes, std::move(payloads), make_options(4, split_policy_t::midpoint, 4, true, 10));
+        for (auto const& q : queries) {
+            std::vector<uint64_t> got;
+            tree.query(q, [&](std::unique_ptr<int> const& p) { got.push_back(uint64_t(*p)); });
+            std::sort(got.begin(), got.end());
+            REQUIRE(got == brute_force(boxes, q));
+        }
+    }
+
+    SECTION("spans") {
+        std::vector<uint32_t> payloads;
+        for (size_t i=0; i<boxes.size(); i++) payloads.push_back(uint32_t(i * 7 + 3));
+
+        // a slice of the input, the payloads still identify their boxes
+        std::span<aabb_t const> in = std::span<aabb_t const>(boxes).subspan(100, 1000);
+        std::span<uint32_t const> data = std::span<uint32_t const>(payloads).subspan(100, 1000);
+        std::vector<aabb_t> sliced(in.begin(), in.end());
+
+        alh::loose_quadtree_t<uint32_t, 5> tree{alh::loose_quadtree_t<uint32_t, 5>::allocator_type()};
+        tree.build(in, data);
+        for (auto const& q : queries) {
+            std::vector<uint64_t> got;
+            tree.query(q, [&](uint32_t p) { got.push_back((p - 3) / 7 - 100); });
+            std::sort(got.begin(), got.end());
+            REQUIRE(got == brute_force(sliced, q));
+        }
+    }
+
+    SECTION("structure of arrays through projections") {
+        // columns as a game would keep them, the tree is built over entity indices
+        std::vector<float> x, y, w, h;
+        std::vector<uint64_t> ids;
+        for (size_t i=0; i<boxes.size(); i++) {
+            x.push_back(boxes[i].min.x);
+            y.push_back(boxes[i].min.y);
+            w.push_back(boxes[i].max.x - boxes[i].min.x);
+            h.push_back(boxes[i].max.y - boxes[i].min.y);
+            ids.push_back(i + 1000);
+        }
+        std::vector<aabb_t> rebuilt;
+        for (size_t i=0; i<boxes.size(); i++) rebuilt.push_back(make_box(x[i], y[i], w[i], h[i]));
+
+        alh::loose_quadtree_t<uint64_t, 5> tree{alh::loose_quadtree_t<uint64_t, 5>::allocator_type()};
+        auto first = std::views::iota(size_t(0)).begin();
+        tree.build(first, first + boxes.size(),
+                   [&](size_t i) { return make_box(x[i], y[i], w[i], h[i]); },
+                   [&](size_t i) { return ids[i]; });
+        for (auto const& q : queries) {
+            std::vector<uint64_t> got;
+            tree.query(q, [&](uint64_t id) { got.push_back(id - 1000); });
+            std::sort(got.begin(), got.end());
+            REQUIRE(got == brute_force(rebuilt, q));
+        }
+    }
+}
+
+TEST_CASE("builds into a fixed arena never reach past it", "[query][pmr]") {
+    auto rng = alh::rand_f32();
+    rng.seed(30);
+
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    auto boxes = random_boxes<aabb_t>(rng, dataset_t::mixed, 3000);
+    std::vector<uint32_t> payloads;
+    for (size_t i=0; i<boxes.size(); i++) payloads.push_back(uint32_t(i));
+    auto queries = random_queries<aabb_t>(rng, 200);
+
+    // the upstream throws on any allocation, so the whole tree has to come out of the buffer. the
+    // worker threads of a parallel build keep their subtrees on the heap and must not touch it
+    for (uint32_t threads : {1u, 4u}) {
+        std::vector<std::byte> buffer(4 << 20);
+        std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+
+        using tree_t = alh::pmr_loose_quadtree_t<uint32_t, 8>;
+        tree_t tree(boxes, payloads, make_options(2, split_policy_t::midpoint, threads, false, build_options_t::template_depth), &arena);
+        REQUIRE(&arena == tree.get_allocator().resource());
+
+        CAPTURE(threads);
+        for (auto const& q : queries) {
+            std::vector<uint64_t> got;
+            tree.query(q, [&](uint32_t i) { got.push_back(i); });
+            std::sort(got.begin(), got.end());
+            REQUIRE(got == brute_force(boxes, q));
+        }
+    }
+}
+
+TEST_CASE("parallel builds lay out the tree like a serial one for any thread budget", "[query][parallel]") {
+    auto rng = alh::rand_f32();
+    rng.seed(26);
+
+    using tree_t = alh::loose_quadtree_t<void, 8>;
+    auto layout = [](tree_t const& tree) {
+        std::ostringstream os;
+        tree.serialize(os);
+        return os.str();
+    };
+
+    for (dataset_t kind : {dataset_t::uniform, dataset_t::clustered, dataset_t::mixed}) {
+        auto boxes = random_boxes<alh::loose_quadtree::aabb_t>(rng, kind, 5000);
+        for (bool compress : {false, true}) {
+            auto opts = make_options(2, split_policy_t::centers, 1, compress, build_options_t::template_depth);
+            tree_t serial(boxes, opts);
+
+            for (uint32_t threads : {2u, 3u, 4u, 5u, 7u, 16u}) {
+                opts.threads = threads;
+                tree_t parallel(boxes, opts);
+                CAPTURE(int(kind), compress, threads);
+                REQUIRE(layout(parallel) == layout(serial));
+            }
+        }
+    }
+}
+
+TEST_CASE("union queries report every entry once", "[query][union]") {
+    auto rng = alh::rand_f32();
+    rng.seed(49);
+
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    using tree_t = alh::loose_quadtree_t<void, 8>;
+    tree_t tree{tree_t::allocator_type()};
+    auto queries = random_queries<aabb_t>(rng, 300);
+
+    for (dataset_t kind : all_datasets) {
+        auto boxes = random_boxes<aabb_t>(rng, kind, 2000);
+
+        for (build_options_t const& opts : all_options()) {
+            tree.build(boxes, opts);
+
+            // sets of up to 9 boxes, often overlapping and some repeated
+            for (size_t q=0; q+9<queries.size(); q+=5) {
+                std::vector<aabb_t> set(queries.begin() + q, queries.begin() + q + (q % 9) + 1);
+                if (q % 4 == 0) set.push_back(set.front());
+
+                std::vector<uint64_t> expected;
+                for (uint64_t i=0; i<boxes.size(); i++) {
+                    if (std::any_of(set.begin(), set.end(), [&](aabb_t const& bb) { return bb.intersect(boxes[i]); })) expected.push_back(i);
+                }
+
+                std::vector<uint64_t> got;
+                tree.query_any(set, [&](uint64_t i) { got.push_back(i); });
+                std::sort(got.begin(), got.end());
+                CAPTURE(int(kind), opts.leaf_size, int(opts.split_policy), opts.threads, opts.compress_paths, opts.max_depth, q);
+                REQUIRE(got == expected);
+            }
+        }
+    }
+
+    tree.query_any(std::span<aabb_t const>(), [](uint64_t) { FAIL("an empty set finds nothing"); });
+}
+
+TEST_CASE("query_into fills buffers in leaf order and reports overflow", "[query][into]") {
+    auto rng = alh::rand_f32();
+    rng.seed(50);
+
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    using tree_t = alh::loose_quadtree_t<void, 8>;
+    tree_t tree{tree_t::allocator_type()};
+    auto queries = random_queries<aabb_t>(rng, 200);
+
+    for (dataset_t kind : all_datasets) {
+        auto boxes = random_boxes<aabb_t>(rng, kind, 2000);
+        tree.build(boxes);
+
+        std::vector<uint64_t> buffer(64);
+        for (auto const& q : queries) {
+            std::vector<uint64_t> in_order;
+            tree.query(q, [&](uint64_t i) { in_order.push_back(i); });
+
+            size_t n = tree.query_into(q, buffer);
+            CAPTURE(int(kind), q.min.x, q.min.y, q.max.x, q.max.y);
+            REQUIRE(n == in_order.size());
+            REQUIRE(std::equal(buffer.begin(), buffer.begin() + std::min(n, buffer.size()), in_order.begin()));
+
+            // a buffer of the reported size takes everything
+            std::vector<uint64_t> exact(n);
+            REQUIRE(tree.query_into(q, exact) == n);
+            REQUIRE(exact == in_order);
+
+            std::vector<uint64_t> appended(n + 1, uint64_t(-1));
+            REQUIRE(tree.query_into(q, appended.data()) == appended.data() + n);
+            REQUIRE(uint64_t(-1) == appended.back());
+            appended.pop_back();
+            REQUIRE(appended == in_order);
+
+            std::sort(appended.begin(), appended.end());
+            REQUIRE(appended == brute_force(boxes, q));
+        }
+    }
+}
+
+TEST_CASE("updates and rebuild_dirty match brute force", "[query][update]") {
+    auto rng = alh::rand_f32();
+    rng.seed(44);
+
+    using tree_t = alh::loose_quadtree_t<void, 8>;
+    tree_t tree{tree_t::allocator_type()};
+    auto queries = random_queries<alh::loose_quadtree::aabb_t>(rng, 100);
+
+    for (build_options_t const& opts : all_options()) {
+        auto boxes = random_boxes<alh::loose_quadtree::aabb_t>(rng, dataset_t::mixed, 2000);
+        tree.build(boxes, opts);
+
+        for (int round=0; round<6; round++) {
+            // mostly small moves in one corner, a few entries jump across the world
+            for (int k=0; k<100; k++) {
+                uint64_t i = uint64_t(rng.get_uniform(0.f, float(boxes.size()))) % boxes.size();
+                auto &bb = boxes[i];
+                float dx = rng.get_uniform(-3.f, 3.f), dy = rng.get_uniform(-3.f, 3.f);
+                if (k % 25 == 0) {
+                    bb = random_box<alh::loose_quadtree::aabb_t>(rng, dataset_t::uniform);
+                } else {
+                    bb.min.x += dx; bb.max.x += dx;
+                    bb.min.y += dy; bb.max.y += dy;
+                }
+                tree.update(i, bb);
+            }
+
+            CAPTURE(opts.leaf_size, int(opts.split_policy), opts.threads, opts.compress_paths, opts.max_depth, round);
+            for (auto const& q : queries) REQUIRE(by_visitor(tree, q) == brute_force(boxes, q));
+
+            size_t rebuilt = tree.rebuild_dirty();
+            REQUIRE(rebuilt <= boxes.size());
+            REQUIRE(0 == tree.rebuild_dirty());
+
+            for (auto const& q : queries) {
+                auto expected = brute_force(boxes, q);
+                REQUIRE(by_query_start(tree, q) == expected);
+                REQUIRE(by_visitor(tree, q) == expected);
+            }
+
+            auto report = tree.analyze();
+            REQUIRE(report.n_entries == boxes.size());
+            REQUIRE(report.n_nodes <= tree.memory_usage().nodes.used / sizeof(uint64_t) / tree_t::n_children);
+
+            // padding nodes survive the flat format
+            std::ostringstream os;
+            tree.serialize(os);
+            flat_buffer_t buffer(os.str());
+            alh::loose_quadtree_view_t<void> view(buffer.blocks.data(), buffer.size);
+            for (auto const& q : queries) REQUIRE(by_view(view, q) == brute_force(boxes, q));
+        }
+    }
+}
+
+TEST_CASE("a few local moves only rebuild a few subtrees", "[query][update]") {
+    auto rng = alh::rand_f32();
+    rng.seed(45);
+
+    using tree_t = alh::loose_quadtree_t<void, 10>;
+    auto boxes = random_boxes<alh::loose_quadtree::aabb_t>(rng, dataset_t::uniform, 20000);
+    tree_t tree(boxes);
+
+    for (uint64_t i=0; i<boxes.size(); i+=1000) {
+        boxes[i].min.x += 0.5f;
+        boxes[i].max.x += 0.5f;
+        tree.update(i, boxes[i]);
+    }
+    REQUIRE(tree.rebuild_dirty() < boxes.size() / 10);
+    for (auto const& q : random_queries<alh::loose_quadtree::aabb_t>(rng, 200)) {
+        REQUIRE(by_visitor(tree, q) == brute_force(boxes, q));
+    }
+}
+
+TEST_CASE("bursts of updates across the tree rebuild in one pass", "[query][update]") {
+    auto rng = alh::rand_f32();
+    rng.seed(441);
+
+    // every tenth entry of one quadrant of the root moves, so many sibling subtrees are rebuilt
+    // and outgrow their range at once. moves stay in their cell two levels down, leaving it would
+    // mark a node holding most of the entries (or the root)
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    using point_t = alh::loose_quadtree::point_t;
+    using tree_t = alh::loose_quadtree_t<void, 10>;
+    auto boxes = random_boxes<aabb_t>(rng, dataset_t::uniform, 20000);
+    tree_t tree(boxes);
+
+    // centers and cells the way the tree computes them, the root cell is the bounds of the centers
+    auto center = [](aabb_t const& bb) { return point_t{(bb.min.x + bb.max.x) / 2.f, (bb.min.y + bb.max.y) / 2.f}; };
+    aabb_t root = make_box(1e9f, 1e9f, -2e9f, -2e9f);
+    for (aabb_t const& bb : boxes) root.extend(center(bb));
+    auto cell_of = [&](point_t const& p) {
+        aabb_t cell = root;
+        int key = 0;
+        for (int level=0; level<2; level++) {
+            point_t mid = center(cell);
+            int k = int(p.x >= mid.x) + 2 * int(p.y >= mid.y);
+            (k & 1 ? cell.min.x : cell.max.x) = mid.x;
+            (k & 2 ? cell.min.y : cell.max.y) = mid.y;
+            key = 4 * key + k;
+        }
+        bool inside = root.min.x <= p.x && p.x <= root.max.x && root.min.y <= p.y && p.y <= root.max.y;
+        return inside ? key : -1;
+    };
+
+    for (int round=0; round<4; round++) {
+        for (uint64_t i=round; i<boxes.size(); i+=10) {
+            int key = cell_of(center(boxes[i]));
+            if (key < 0 || key >= 4) continue;
+            float dx = rng.get_uniform(-4.f, 4.f), dy = rng.get_uniform(-4.f, 4.f);
+            aabb_t bb = boxes[i];
+            bb.min.x += dx; bb.max.x += dx;
+            bb.min.y += dy; bb.max.y += dy;
+            if (cell_of(center(bb)) != key) continue;
+            boxes[i] = bb;
+            tree.update(i, boxes[i]);
+        }
+        CAPTURE(round);
+        REQUIRE(tree.rebuild_dirty() < boxes.size());
+        for (auto const& q : random_queries<alh::loose_quadtree::aabb_t>(rng, 100)) {
+            REQUIRE(by_visitor(tree, q) == brute_force(boxes, q));
+        }
+    }
+    REQUIRE(tree.analyze().n_entries == boxes.size());
+}
+
+TEST_CASE("entries moving across the tree leave it as good as a fresh build", "[query][update][analyze]") {
+    auto rng = alh::rand_f32();
+    rng.seed(442);
+
+    // on even ticks entries respawn anywhere, which crosses the children of the root. on odd
+    // ticks they respawn inside one child, far from its border, which rebuilds only below it
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    using tree_t = alh::loose_quadtree_t<void, 10>;
+    auto boxes = random_boxes<aabb_t>(rng, dataset_t::uniform, 20000);
+    tree_t tree(boxes);
+
+    for (int tick=0; tick<10; tick++) {
+        size_t moved = 0;
+        for (uint64_t i=0; i<boxes.size() && moved<200; i+=37) {
+            uint64_t k = (i + 7919 * tick) % boxes.size();
+            float w = boxes[k].max.x - boxes[k].min.x, h = boxes[k].max.y - boxes[k].min.y;
+            if (tick % 2 == 0) {
+                boxes[k] = make_box(rng.get_uniform(0.f, 1000.f), rng.get_uniform(0.f, 1000.f), w, h);
+            } else if (boxes[k].max.x < 400.f && boxes[k].max.y < 400.f) {
+                boxes[k] = make_box(rng.get_uniform(50.f, 380.f), rng.get_uniform(50.f, 380.f), w, h);
+            } else {
+                continue;
+            }
+            tree.update(k, boxes[k]);
+            moved++;
+        }
+        size_t rebuilt = tree.rebuild_dirty();
+
+        auto report = tree.analyze();
+        auto fresh = tree_t(boxes).analyze();
+        CAPTURE(tick, rebuilt, report.sibling_overlap, fresh.sibling_overlap, report.expected_nodes_visited, fresh.expected_nodes_visited);
+        if (tick % 2 == 1) REQUIRE(rebuilt < boxes.size() / 2);
+        REQUIRE(report.sibling_overlap <= fresh.sibling_overlap * 1.05);
+        REQUIRE(report.expected_nodes_visited <= fresh.expected_nodes_visited * 1.05);
+    }
+}
+
+TEST_CASE("rebuilt subtrees keep the depth budget of compressed paths", "[query][update]") {
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    using tree_t = alh::loose_quadtree_t<void, 16>;
+
+    // the root child near the origin compresses 8 levels before it branches into g1 and g2, which
+    // leaves g1 6 levels. the pair in g1 needs about 10 more to be separated, so it shares a leaf
+    auto point = [](float x, float y) { return make_box<aabb_t>(x - 1e-5f, y - 1e-5f, 2e-5f, 2e-5f); };
+    std::vector<aabb_t> boxes = {
+        point(0.f, 0.f), point(0.9f, 0.9f), point(0.5f, 0.5f), point(0.5f + 1.f / 4096.f, 0.5f), // g1
+        point(1.5f, 0.5f), point(1.6f, 0.6f),                                                   // g2
+        point(1024.f, 1024.f), point(1000.f, 1010.f), point(1010.f, 1000.f), point(990.f, 1020.f),
+    };
+
+    build_options_t opts;
+    opts.compress_paths = true;
+    tree_t tree(boxes, opts);
+    REQUIRE(2 == tree.analyze().max_leaf_size);
+
+    // moves across g1, which rebuilds g1 (the far points keep it from holding most of the entries).
+    // counting ancestors it would get 14 levels and split the pair
+    boxes[1] = point(0.1f, 0.8f);
+    tree.update(1, boxes[1]);
+    REQUIRE(4 == tree.rebuild_dirty());
+    REQUIRE(2 == tree.analyze().max_leaf_size);
+
+    auto rng = alh::rand_f32();
+    rng.seed(440);
+    for (auto const& q : random_queries<aabb_t>(rng, 50)) {
+        REQUIRE(by_visitor(tree, q) == brute_force(boxes, q));
+    }
+}
+
+TEST_CASE("swept queries match brute force in time order", "[query][swept]") {
+    auto rng = alh::rand_f32();
+    rng.seed(46);
+
+    using tree_t = alh::loose_quadtree_t<void, 6>;
+    using aabb_t = alh::loose_quadtree::aabb_t;
+
+    for (dataset_t kind : {dataset_t::uniform, dataset_t::zero_area, dataset_t::mixed}) {
+        auto boxes = random_boxes<aabb_t>(rng, kind, 3000);
+        tree_t tree(boxes);
+        std::vector<tree_t::swept_hit_t> hits;
+
+        for (int i=0; i<300; i++) {
+            float s = (i % 3 == 0) ? 0.f : rng.get_uniform(0.f, 20.f);
+            aabb_t box = make_box<aabb_t>(rng.get_uniform(-100.f, 1100.f), rng.get_uniform(-100.f, 1100.f), s, s);
+            alh::loose_quadtree::point_t delta = {rng.get_uniform(-400.f, 400.f), rng.get_uniform(-400.f, 400.f)};
+            if (i % 5 == 0) delta.y = 0.f;
+            if (i % 7 == 0) delta = {0.f, 0.f};
+            CAPTURE(int(kind), box.min.x, box.min.y, s, delta.x, delta.y);
+
+            tree.query_swept(box, delta, hits);
+            std::vector<uint64_t> got;
+            for (size_t j=0; j<hits.size(); j++) {
+                REQUIRE(hits[j].toi >= 0.f);
+                REQUIRE(hits[j].toi <= 1.f);
+                if (j > 0) REQUIRE(hits[j-1].toi <= hits[j].toi);
+                got.push_back(hits[j].data);
+            }
+            std::sort(got.begin(), got.end());
+            REQUIRE(std::adjacent_find(got.begin(), got.end()) == got.end());
+
+            // every box overlapped at some sampled time is a hit, touched no later than that
+            for (float t=0.f; t<=1.f; t+=0.0625f) {
+                aabb_t at = box;
+                at.min.x += t * delta.x; at.max.x += t * delta.x;
+                at.min.y += t * delta.y; at.max.y += t * delta.y;
+                for (uint64_t k : brute_force(boxes, at)) {
+                    auto it = std::find_if(hits.begin(), hits.end(), [&](auto const& h) { return h.data == k; });
+                    REQUIRE(it != hits.end());
+                    REQUIRE(it->toi <= t + 1e-4f);
+                }
+            }
+
+            // and nothing outside the bounding box of the sweep
+            aabb_t bounds = box;
+            bounds.extend(alh::loose_quadtree::point_t{box.min.x + delta.x, box.min.y + delta.y});
+            bounds.extend(alh::loose_quadtree::point_t{box.max.x + delta.x, box.max.y + delta.y});
+            bounds.max.x = std::nextafter(bounds.max.x, 1e30f);
+            bounds.max.y = std::nextafter(bounds.max.y, 1e30f);
+            bounds.min.x = std::nextafter(bounds.min.x, -1e30f);
+            bounds.min.y = std::nextafter(bounds.min.y, -1e30f);
+            auto candidates = brute_force(boxes, bounds);
+            REQUIRE(std::includes(candidates.begin(), candidates.end(), got.begin(), got.end()));
+        }
+    }
+}
+
+TEST_CASE("kinetic queries match brute force at any time", "[query][kinetic]") {
+    auto rng = alh::rand_f32();
+    rng.seed(47);
+
+    using tree_t = alh::loose_quadtree_t<void, 8>;
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    using point_t = alh::loose_quadtree::point_t;
+
+    auto at = [](std::vector<aabb_t> const& boxes, std::vector<point_t> const& velocity, float t) {
+        std::vector<aabb_t> out = boxes;
+        for (size_t i=0; i<out.size(); i++) {
+            out[i].min.x += t * velocity[i].x; out[i].max.x += t * velocity[i].x;
+            out[i].min.y += t * velocity[i].y; out[i].max.y += t * velocity[i].y;
+        }
+        return out;
+    };
+    auto check = [&](tree_t const& tree, std::vector<aabb_t> const& boxes, std::vector<point_t> const& velocity) {
+        for (float t : {0.f, 1.f / 144.f, 1.f / 30.f, -1.f / 60.f, 1.f, 10.f}) {
+            auto moved = at(boxes, velocity, t);
+            for (auto const& q : random_queries<aabb_t>(rng, 40)) {
+                std::vector<uint64_t> got;
+                tree.query_at(q, t, [&](uint64_t i) { got.push_back(i); });
+                std::sort(got.begin(), got.end());
+                CAPTURE(t, q.min.x, q.min.y, q.max.x, q.max.y);
+                REQUIRE(got == brute_force(moved, q));
+            }
+        }
+    };
+
+    for (build_options_t const& opts : all_options()) {
+        auto boxes = random_boxes<aabb_t>(rng, dataset_t::mixed, 2000);
+        std::vector<point_t> velocity;
+        for (size_t i=0; i<boxes.size(); i++) {
+            float speed = (i % 10 == 0) ? 0.f : rng.get_uniform(10.f, 300.f);
+            velocity.push_back({speed * rng.get_uniform(-1.f, 1.f), speed * rng.get_uniform(-1.f, 1.f)});
+        }
+
+        tree_t tree{tree_t::allocator_type()};
+        tree.build(boxes, velocity, opts);
+        CAPTURE(opts.leaf_size, int(opts.split_policy), opts.compress_paths, opts.max_depth);
+        check(tree, boxes, velocity);
+
+        // a low-rate tick: move everything to t = 1/30, change some velocities, rebuild the dirty parts
+        boxes = at(boxes, velocity, 1.f / 30.f);
+        for (size_t i=0; i<boxes.size(); i++) {
+            if (i % 7 == 0) velocity[i] = {rng.get_uniform(-500.f, 500.f), rng.get_uniform(-500.f, 500.f)};
+            tree.update(i, boxes[i], velocity[i]);
+        }
+        check(tree, boxes, velocity);
+        tree.rebuild_dirty();
+        check(tree, boxes, velocity);
+    }
+}
+
+TEST_CASE("octree and integer coordinates match brute force", "[query]") {
+    auto rng = alh::rand_f32();
+    rng.seed(39);
+
+    SECTION("octree") {
+        using aabb3_t = alh::loose_quadtree::aabb3_t;
+        auto random_box3 = [&](float size) {
+            aabb3_t bb;
+            bb.min = {rng.get_uniform(0.f, 500.f), rng.get_uniform(0.f, 500.f), rng.get_uniform(0.f, 500.f)};
+            bb.max = {bb.min.x + rng.get_uniform(0.f, size), bb.min.y + rng.get_uniform(0.f, size), bb.min.z + rng.get_uniform(0.f, size)};
+            return bb;
+        };
+
+        std::vector<aabb3_t> boxes;
+        for (int i=0; i<2000; i++) boxes.push_back(random_box3(20.f));
+
+        using tree_t = alh::loose_octree_t<void, 5>;
+        tree_t tree{tree_t::allocator_type()};
+        for (build_options_t const& opts : all_options()) {
+            tree.build(boxes, opts);
+            for (int i=0; i<100; i++) {
+                aabb3_t q = random_box3(150.f);
+                auto expected = brute_force(boxes, q);
+                REQUIRE(by_query_start(tree, q) == expected);
+                REQUIRE(by_visitor(tree, q) == expected);
+            }
+        }
+    }
+
+    SECTION("int32") {
+        using tree_t = alh::loose_quadtree_t<void, 6, 2, int32_t>;
+        using aabb_t = tree_t::aabb_t;
+        auto random_ibox = [&](float size) {
+            aabb_t bb;
+            bb.min = {int32_t(rng.get_uniform(-1e6f, 1e6f)), int32_t(rng.get_uniform(-1e6f, 1e6f))};
+            bb.max = {bb.min.x + int32_t(rng.get_uniform(0.f, size)), bb.min.y + int32_t(rng.get_uniform(0.f, size))};
+            return bb;
+        };
+
+        std::vector<aabb_t> boxes;
+        for (int i=0; i<2000; i++) boxes.push_back(random_ibox(3e4f));
+
+        tree_t tree{tree_t::allocator_type()};
+        for (build_options_t const& opts : all_options()) {
+            tree.build(boxes, opts);
+            for (int i=0; i<100; i++) {
+                aabb_t q = random_ibox(2e5f);
+                auto expected = brute_force(boxes, q);
+                REQUIRE(by_query_start(tree, q) == expected);
+                REQUIRE(by_visitor(tree, q) == expected);
+            }
+        }
+    }
+}
+
+TEST_CASE("flat view matches brute force", "[query][flat]") {
+    auto rng = alh::rand_f32();
+    rng.seed(40);
+
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    auto queries = random_queries<aabb_t>(rng, 200);
+
+    SECTION("serialized tree") {
+        for (dataset_t kind : all_datasets) {
+            auto boxes = random_boxes<aabb_t>(rng, kind, 1500);
+            alh::loose_quadtree_t<void, 6> tree(boxes, make_options(4, split_policy_t::centers, 1, true, 10));
+            std::ostringstream os;
+            tree.serialize(os);
+
+            flat_buffer_t buf(os.str());
+            alh::loose_quadtree_view_t<void> view(buf.blocks.data(), buf.size);
+            CAPTURE(int(kind));
+            REQUIRE(view);
+            REQUIRE(boxes.size() == view.size());
+            for (auto const& q : queries) REQUIRE(by_view(view, q) == brute_force(boxes, q));
+        }
+    }
+
+    SECTION("external builder") {
+        using builder_t = alh::loose_quadtree_external_builder_t<void, 6>;
+        builder_t::options_t opts;
+        opts.bounds = make_box<aabb_t>(0.f, 0.f, 1000.f, 1000.f);
+
+        for (dataset_t kind : all_datasets) {
+            auto boxes = random_boxes<aabb_t>(rng, kind, 1500);
+            std::ostringstream os;
+            {
+                builder_t builder(opts);
+                std::span<aabb_t const> in(boxes);
+                builder.add(in.first(in.size() / 2));
+                builder.add(in.subspan(in.size() / 2));
+                REQUIRE(builder.finish(os));
+            }
+
+            flat_buffer_t buf(os.str());
+            alh::loose_quadtree_view_t<void> view(buf.blocks.data(), buf.size);
+            CAPTURE(int(kind));
+            REQUIRE(view);
+            REQUIRE(boxes.size() == view.size());
+            for (auto const& q : queries) REQUIRE(by_view(view, q) == brute_force(boxes, q));
+        }
+    }
+}
+
+TEST_CASE("external builds keep one file open whatever the number of buckets", "[query][flat]") {
+    auto rng = alh::rand_f32();
+    rng.seed(34);
+
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    using builder_t = alh::loose_quadtree_external_builder_t<void, 10>;
+    auto boxes = random_boxes<aabb_t>(rng, dataset_t::scattered, 20000);
+    auto queries = random_queries<aabb_t>(rng, 200);
+
+#if __has_include(<sys/resource.h>)
+    // far fewer descriptors than the 1024 buckets, restored when the test ends
+    struct limit_t {
+        rlimit old;
+        limit_t() {
+            getrlimit(RLIMIT_NOFILE, &old);
+            rlimit low = old;
+            low.rlim_cur = std::min<rlim_t>(old.rlim_cur, 64);
+            setrlimit(RLIMIT_NOFILE, &low);
+        }
+        ~limit_t() { setrlimit(RLIMIT_NOFILE, &old); }
+    } limit;
+#endif
+
+    // everything buffered until finish, and spilled to the bucket files many times over
+    for (uint64_t buffer_bytes : {uint64_t(64) << 20, uint64_t(16) << 10}) {
+        builder_t::options_t opts;
+        opts.bounds = make_box<aabb_t>(0.f, 0.f, 1000.f, 1000.f);
+        opts.bucket_depth = 5;
+        opts.buffer_bytes = buffer_bytes;
+
+        std::ostringstream os;
+        {
+            builder_t builder(opts);
+            std::span<aabb_t const> in(boxes);
+            for (size_t at=0; at<in.size(); at+=1000) builder.add(in.subspan(at, std::min<size_t>(1000, in.size() - at)));
+            bool ok = builder.finish(os);
+            CAPTURE(buffer_bytes, builder.error());
+            REQUIRE(ok);
+            REQUIRE(builder.error().empty());
+        }
+
+        flat_buffer_t buf(os.str());
+        alh::loose_quadtree_view_t<void> view(buf.blocks.data(), buf.size);
+        REQUIRE(view);
+        REQUIRE(boxes.size() == view.size());
+        for (auto const& q : queries) REQUIRE(by_view(view, q) == brute_force(boxes, q));
+    }
+}
+
+TEST_CASE("external builds say why they failed", "[query][flat]") {
+    auto rng = alh::rand_f32();
+    rng.seed(340);
+
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    using builder_t = alh::loose_quadtree_external_builder_t<void, 8>;
+    auto boxes = random_boxes<aabb_t>(rng, dataset_t::uniform, 2000);
+
+    // fails while adding when the buckets spill, otherwise in finish
+    for (uint64_t buffer_bytes : {uint64_t(64) << 20, uint64_t(1) << 10}) {
+        builder_t::options_t opts;
+        opts.bounds = make_box<aabb_t>(0.f, 0.f, 1000.f, 1000.f);
+        opts.temp_dir = std::filesystem::temp_directory_path() / "alh_no_such_dir" / "nested";
+        opts.buffer_bytes = buffer_bytes;
+
+        builder_t builder(opts);
+        builder.add(boxes);
+        std::ostringstream os;
+        bool ok = builder.finish(os);
+        CAPTURE(buffer_bytes, builder.error());
+        REQUIRE(!ok);
+        REQUIRE(std::string::npos != builder.error().find("alh_no_such_dir"));
+    }
+}
+
+#if defined(ALH_LOOSE_QUADTREE_HAS_MMAP)
+TEST_CASE("flat view queries a memory-mapped file", "[query][flat]") {
+    auto rng = alh::rand_f32();
+    rng.seed(33);
+
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    auto boxes = random_boxes<aabb_t>(rng, dataset_t::mixed, 2000);
+    alh::loose_quadtree_t<void, 8> tree(boxes);
+
+    auto path = std::filesystem::temp_directory_path() / ("alh_flat_view_" + std::to_string(::getpid()) + ".bin");
+    {
+        std::ofstream os(path, std::ios::binary);
+        tree.serialize(os);
+        REQUIRE(os);
+    }
+
+    {
+        alh::mapped_file_t file(path.c_str());
+        REQUIRE(file);
+        alh::loose_quadtree_view_t<void> view(file.data(), file.size());
+        REQUIRE(view);
+        REQUIRE(boxes.size() == view.size());
+        for (auto const& q : random_queries<aabb_t>(rng, 200)) REQUIRE(by_view(view, q) == brute_force(boxes, q));
+    }
+    std::filesystem::remove(path);
+
+    REQUIRE(!alh::mapped_file_t(path.c_str()));
+}
+#endif
+
+TEST_CASE("flat view rejects buffers it cannot read", "[query][flat]") {
+    auto rng = alh::rand_f32();
+    rng.seed(330);
+
+    using aabb_t = alh::loose_quadtree::aabb_t;
+    using flat_header_t = alh::loose_quadtree::flat_header_t;
+    auto boxes = random_boxes<aabb_t>(rng, dataset_t::uniform, 500);
+
+    std::ostringstream os;
+    alh::loose_quadtree_t<void, 6>(boxes).serialize(os);
+    std::string const bytes = os.str();
+    {
+        flat_buffer_t buf(bytes);
+        REQUIRE(alh::loose_quadtree_view_t<void>(buf.blocks.data(), buf.size));
+    }
+
+    SECTION("truncated") {
+        flat_buffer_t buf(bytes);
+        for (size_t size : {size_t(0), sizeof(flat_header_t) - 1, sizeof(flat_header_t), bytes.size() / 2, bytes.size() - 1}) {
+            CAPTURE(size);
+            REQUIRE(!alh::loose_quadtree_view_t<void>(buf.blocks.data(), size));
+        }
+    }
+
+    SECTION("wrong version") {
+        flat_buffer_t buf(bytes);
+        auto *h = reinterpret_cast<flat_header_t*>(buf.blocks.data());
+        h->version++;
+        REQUIRE(!alh::loose_quadtree_view_t<void>(buf.blocks.data(), buf.size));
+    }
+
+    SECTION("wrong dimension") {
+        // a view of the wrong dimension, and an octree read as a quadtree
+        flat_buffer_t buf(bytes);
+        REQUIRE(!alh::loose_quadtree_view_t<void, 3>(buf.blocks.data(), buf.size));
+
+        std::vector<alh::loose_quadtree::basic_aabb_t<3>> boxes3;
+        for (aabb_t const& bb : boxes) boxes3.push_back({{bb.min.x, bb.min.y, 0.f}, {bb.max.x, bb.max.y, 1.f}});
+        std::ostringstream os3;
+        alh::loose_octree_t<void, 6>(boxes3).serialize(os3);
+        flat_buffer_t buf3(os3.str());
+        REQUIRE(alh::loose_quadtree_view_t<void, 3>(buf3.blocks.data(), buf3.size));
+        REQUIRE(!alh::loose_quadtree_view_t<void>(buf3.blocks.data(), buf3.size));
+    }
+
+    SECTION("wrong payload size") {
+        // input indices are 8 bytes, a 4-byte payload reads the same buffer differently
+        flat_buffer_t buf(bytes);
+        REQUIRE(alh::loose_quadtree_view_t<uint64_t>(buf.blocks.data(), buf.size));
+        REQUIRE(!alh::loose_quadtree_view_t<uint32_t>(buf.blocks.data(), buf.size));
+
+        std::vector<uint32_t> payloads(boxes.size(), 7u);
+        std::ostringstream os32;
+        alh::loose_quadtree_t<uint32_t, 6>(boxes, payloads).serialize(os32);
+        flat_buffer_t buf32(os32.str());
+        REQUIRE(alh::loose_quadtree_view_t<uint32_t>(buf32.blocks.data(), buf32.size));
+        REQUIRE(!alh::loose_quadtree_view_t<void>(buf32.blocks.data(), buf32.size));
+    }
+}
@@ -0,0 +1,153 @@
+// the double-buffered snapshot: readers on other threads only ever see whole builds, and the
+// writer never rebuilds a buffer that a reader still has pinned
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "rand.hpp"
+#include "test_util.hpp"
+#include "loose_quadtree.hpp"
+#include "loose_quadtree_snapshot.hpp"
+
+namespace {
+
+using namespace alh::test;
+using aabb_t = alh::loose_quadtree::aabb_t;
+using tree_t = alh::loose_quadtree_t<void, 8>;
+using snapshot_t = alh::loose_quadtree_snapshot_t<tree_t, 8>;
+
+// two datasets with different sizes in disjoint halves of the world, so that any result tells
+// which build it came from
+struct build_t {
+    std::vector<aabb_t> boxes;
+    std::vector<uint64_t> all;     // what the whole-world query returns
+    std::vector<uint64_t> partial; // what the partial query returns
+};
+
+aabb_t const everything = make_box(-1e4f, -1e4f, 2e4f, 2e4f);
+aabb_t const partial_query = make_box(200.f, 200.f, 600.f, 600.f);
+
+build_t make_dataset(alh::rand_f32 &rng, size_t n, float x0) {
+    build_t ds;
+    for (size_t i=0; i<n; i++) {
+        ds.boxes.push_back(make_box(x0 + rng.get_uniform(0.f, 490.f), rng.get_uniform(0.f, 990.f), 5.f, 5.f));
+        ds.all.push_back(i);
+        if (partial_query.intersect(ds.boxes.back())) ds.partial.push_back(i);
+    }
+    return ds;
+}
+
+// 0 or 1 for the dataset the pinned tree holds both results of, -1 for anything else
+int which_dataset(tree_t const& tree, build_t const (&ds)[2]) {
+    auto all = by_visitor(tree, everything);
+    auto partial = by_visitor(tree, partial_query);
+    for (int k=0; k<2; k++) {
+        if (all == ds[k].all && partial == ds[k].partial) return k;
+    }
+    return -1;
+}
+
+}
+
+TEST_CASE("a pin before the first build holds no tree", "[snapshot]") {
+    snapshot_t snapshot;
+    auto reader = snapshot.register_reader();
+    {
+        auto pin = reader.pin();
+        REQUIRE(!pin);
+    }
+    REQUIRE(nullptr == snapshot.published());
+
+    auto rng = alh::rand_f32();
+    rng.seed(35);
+    auto ds = make_dataset(rng, 100, 0.f);
+    snapshot.build(ds.boxes);
+
+    auto pin = reader.pin();
+    REQUIRE(pin);
+    REQUIRE(by_visitor(*pin, everything) == ds.all);
+}
+
+TEST_CASE("concurrent readers only see complete builds", "[snapshot][concurrent]") {
+    auto rng = alh::rand_f32();
+    rng.seed(350);
+    build_t const ds[2] = {make_dataset(rng, 1000, 0.f), make_dataset(rng, 1500, 500.f)};
+
+    snapshot_t snapshot;
+    std::atomic<bool> done = false;
+    std::atomic<uint64_t> n_pinned = 0, n_mixed = 0;
+
+    // catch2 assertions are not thread-safe, readers only count
+    std::vector<std::thread> readers;
+    for (int r=0; r<4; r++) {
+        readers.emplace_back([&] {
+            auto reader = snapshot.register_reader();
+            while (!done.load()) {
+                auto pin = reader.pin();
+                if (!pin) continue;
+                n_pinned++;
+                if (which_dataset(*pin, ds) < 0) n_mixed++;
+            }
+        });
+    }
+
+    for (int i=0; i<300; i++) snapshot.build(ds[i % 2].boxes);
+    done = true;
+    for (std::thread &r : readers) r.join();
+
+    REQUIRE(0 == n_mixed.load());
+    REQUIRE(n_pinned.load() > 0);
+    REQUIRE(1 == which_dataset(*snapshot.published(), ds));
+}
+
+TEST_CASE("build waits for readers pinning the buffer it rebuilds", "[snapshot][concurrent]") {
+    auto rng = alh::rand_f32();
+    rng.seed(351);
+    build_t const ds[2] = {make_dataset(rng, 1000, 0.f), make_dataset(rng, 1500, 500.f)};
+
+    snapshot_t snapshot;
+    snapshot.build(ds[0].boxes);
+
+    std::atomic<bool> pinned = false, release = false, rebuilt = false;
+    std::atomic<int> seen_before = -2, seen_after = -2;
+
+    std::thread reader_thread([&] {
+        auto reader = snapshot.register_reader();
+        auto pin = reader.pin();
+        seen_before = which_dataset(*pin, ds);
+        pinned = true;
+        while (!release.load()) std::this_thread::yield();
+        // the writer was blocked on this buffer all along, so it still holds the first build
+        seen_after = which_dataset(*pin, ds);
+    });
+    while (!pinned.load()) std::this_thread::yield();
+
+    // goes to the other buffer, nothing to wait for
+    snapshot.build(ds[1].boxes);
+    REQUIRE(1 == which_dataset(*snapshot.published(), ds));
+
+    // goes back to the pinned buffer
+    std::thread writer_thread([&] {
+        snapshot.build(ds[0].boxes);
+        rebuilt = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(!rebuilt.load());
+    REQUIRE(1 == which_dataset(*snapshot.published(), ds));
+
+    release = true;
+    reader_thread.join();
+    writer_thread.join();
+
+    REQUIRE(rebuilt.load());
+    REQUIRE(0 == seen_before.load());
+    REQUIRE(0 == seen_after.load());
+    REQUIRE(0 == which_dataset(*snapshot.published(), ds));
+}
@@ -0,0 +1,118 @@
+// traversal counters, only compiled in with ALH_LOOSE_QUADTREE_STATS, and the analyze cost
+// model checked against them
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "rand.hpp"
+#include "test_util.hpp"
+#include "loose_quadtree.hpp"
+
+#if !defined(ALH_LOOSE_QUADTREE_STATS)
+#error "test_stats needs ALH_LOOSE_QUADTREE_STATS"
+#endif
+
+namespace {
+
+using namespace alh::test;
+using aabb_t = alh::loose_quadtree::aabb_t;
+using query_stats_t = alh::loose_quadtree::query_stats_t;
+using tree_t = alh::loose_quadtree_t<void, 8>;
+
+bool same_counters(query_stats_t const& a, query_stats_t const& b) {
+    return a.queries == b.queries && a.nodes_visited == b.nodes_visited && a.nodes_culled == b.nodes_culled
+        && a.entries_tested == b.entries_tested && a.hits == b.hits;
+}
+
+}
+
+TEST_CASE("query counters match brute force and add up", "[stats]") {
+    auto rng = alh::rand_f32();
+    rng.seed(38);
+
+    auto boxes = random_boxes(rng, dataset_t::uniform, 3000);
+    tree_t tree{tree_t::allocator_type()};
+    tree.build(boxes);
+    REQUIRE(same_counters(tree.total_query_stats(), query_stats_t{}));
+
+    query_stats_t sum;
+    for (int i=0; i<300; i++) {
+        float s = (i % 3 == 0) ? 0.f : rng.get_uniform(0.f, 200.f);
+        aabb_t q = make_box(rng.get_uniform(-100.f, 1100.f), rng.get_uniform(-100.f, 1100.f), s, s);
+        uint64_t expected = brute_force(boxes, q).size();
+
+        uint64_t n = 0;
+        for (auto it = tree.query_start(q); it != tree.query_end(); ++it) n++;
+        query_stats_t const last = tree.last_query_stats();
+        CAPTURE(i, q.min.x, q.min.y, s);
+        REQUIRE(n == expected);
+        REQUIRE(1 == last.queries);
+        REQUIRE(last.hits == expected);
+        REQUIRE(last.entries_tested >= last.hits);
+        REQUIRE(last.nodes_visited >= 1);
+        REQUIRE(last.nodes_culled <= last.nodes_visited);
+        sum += last;
+        REQUIRE(same_counters(tree.total_query_stats(), sum));
+
+        // the caller-owned overload counts the same traversal and leaves the tree's counters alone
+        query_stats_t own;
+        tree.query(q, [](uint64_t) {}, own);
+        REQUIRE(same_counters(own, last));
+        REQUIRE(same_counters(tree.last_query_stats(), last));
+        REQUIRE(same_counters(tree.total_query_stats(), sum));
+    }
+    REQUIRE(300 == sum.queries);
+
+    tree.reset_query_stats();
+    REQUIRE(same_counters(tree.last_query_stats(), query_stats_t{}));
+    REQUIRE(same_counters(tree.total_query_stats(), query_stats_t{}));
+}
+
+// the model places queries uniformly so that they overlap the root box: on each axis the query
+// min is uniform in [root.min - size, root.max]. measured averages over many such queries have
+// to agree with it within a few percent, the sampling error at this count is well below that
+TEST_CASE("the analyze cost model matches measured counters on uniform data", "[stats][analyze]") {
+    auto rng = alh::rand_f32();
+    rng.seed(39);
+
+    auto boxes = random_boxes(rng, dataset_t::uniform, 20000);
+    aabb_t domain = boxes.front();
+    for (aabb_t const& bb : boxes) {
+        for (uint32_t d=0; d<2; d++) {
+            domain.min[d] = std::min(domain.min[d], bb.min[d]);
+            domain.max[d] = std::max(domain.max[d], bb.max[d]);
+        }
+    }
+
+    constexpr double tolerance = 0.03;
+    constexpr int n_queries = 20000;
+
+    for (bool compress : {false, true}) {
+        alh::loose_quadtree::build_options_t opts;
+        opts.leaf_size = 8;
+        opts.compress_paths = compress;
+        tree_t tree{tree_t::allocator_type()};
+        tree.build(boxes, opts);
+
+        for (float size : {0.f, 10.f, 100.f}) {
+            auto report = tree.analyze({size, size});
+
+            query_stats_t measured;
+            for (int i=0; i<n_queries; i++) {
+                float x = rng.get_uniform(domain.min.x - size, domain.max.x);
+                float y = rng.get_uniform(domain.min.y - size, domain.max.y);
+                tree.query(make_box(x, y, size, size), [](uint64_t) {}, measured);
+            }
+
+            double nodes = double(measured.nodes_visited) / n_queries;
+            double entries = double(measured.entries_tested) / n_queries;
+            CAPTURE(compress, size, nodes, report.expected_nodes_visited, entries, report.expected_entries_tested);
+            REQUIRE(std::abs(nodes - report.expected_nodes_visited) <= tolerance * report.expected_nodes_visited);
+            REQUIRE(std::abs(entries - report.expected_entries_tested) <= tolerance * report.expected_entries_tested);
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef ALH_TEST_UTIL_HPP
+#define ALH_TEST_UTIL_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "rand.hpp"
+#include "loose_quadtree.hpp"
+
+// random inputs and the brute-force reference shared by the tests
+namespace alh::test {
+
+    enum class dataset_t { uniform, clustered, one_center, zero_area, huge, mixed, scattered };
+
+    // the ones the query tests go through, scattered is made for a world of [0, 1000]^2
+    inline constexpr dataset_t all_datasets[] = {
+        dataset_t::uniform, dataset_t::clustered, dataset_t::one_center,
+        dataset_t::zero_area, dataset_t::huge, dataset_t::mixed,
+    };
+
+    template<typename AABB = loose_quadtree::aabb_t>
+    AABB make_box(float x, float y, float w, float h) {
+        AABB bb;
+        bb.min = {x, y};
+        bb.max = {x + w, y + h};
+        return bb;
+    }
+
+    template<typename AABB = loose_quadtree::aabb_t>
+    AABB random_box(rand_f32 &rng, dataset_t kind) {
+        switch (kind) {
+            case dataset_t::uniform:
+                return make_box<AABB>(rng.get_uniform(0.f, 1000.f), rng.get_uniform(0.f, 1000.f),
+                                      rng.get_uniform(1.f, 20.f), rng.get_uniform(1.f, 20.f));
+            case dataset_t::clustered:
+                return make_box<AABB>(rng.get_normalish(400.f, 600.f), rng.get_normalish(400.f, 600.f),
+                                      rng.get_uniform(0.1f, 5.f), rng.get_uniform(0.1f, 5.f));
+            case dataset_t::one_center: {
+                // every box shares the center (500, 500), so no split can separate them
+                float r = rng.get_uniform(0.5f, 50.f);
+                return make_box<AABB>(500.f - r, 500.f - r, 2.f * r, 2.f * r);
+            }
+            case dataset_t::zero_area: {
+                // points and axis-aligned segments
+                float x = rng.get_uniform(0.f, 1000.f), y = rng.get_uniform(0.f, 1000.f);
+                float w = (rng.get_uniform(0.f, 1.f) < 0.3f) ? rng.get_uniform(0.f, 10.f) : 0.f;
+                return make_box<AABB>(x, y, w, 0.f);
+            }
+            case dataset_t::huge:
+                return make_box<AABB>(rng.get_uniform(-1e6f, 0.f), rng.get_uniform(-1e6f, 0.f),
+                                      rng.get_uniform(1e6f, 3e6f), rng.get_uniform(1e6f, 3e6f));
+            case dataset_t::mixed: {
+                float u = rng.get_uniform(0.f, 1.f);
+                if (u < 0.1f) return random_box<AABB>(rng, dataset_t::huge);
+                if (u < 0.3f) return random_box<AABB>(rng, dataset_t::zero_area);
+                if (u < 0.4f) return random_box<AABB>(rng, dataset_t::one_center);
+                return random_box<AABB>(rng, dataset_t::uniform);
+            }
+            case dataset_t::scattered: {
+                // mostly small boxes inside the world, some huge ones, some points, some outside the world
+                float u = rng.get_uniform(0.f, 1.f);
+                float x = rng.get_uniform(0.f, 1000.f), y = rng.get_uniform(0.f, 1000.f);
+                if (u < 0.05f) return make_box<AABB>(x - 800.f, y - 800.f, rng.get_uniform(500.f, 3000.f), rng.get_uniform(500.f, 3000.f));
+                if (u < 0.15f) return make_box<AABB>(x, y, 0.f, 0.f);
+                if (u < 0.20f) return make_box<AABB>(rng.get_uniform(-3000.f, 4000.f), rng.get_uniform(-3000.f, 4000.f), 10.f, 10.f);
+                float s = rng.get_uniform(0.1f, 40.f);
+                return make_box<AABB>(x, y, s, rng.get_uniform(0.1f, 40.f));
+            }
+        }
+        return {};
+    }
+
+    template<typename AABB = loose_quadtree::aabb_t>
+    std::vector<AABB> random_boxes(rand_f32 &rng, dataset_t kind, size_t n) {
+        std::vector<AABB> boxes;
+        for (size_t i=0; i<n; i++) boxes.push_back(random_box<AABB>(rng, kind));
+        return boxes;
+    }
+
+    // queries of all sizes, including zero-area ones and one covering everything
+    template<typename AABB = loose_quadtree::aabb_t>
+    std::vector<AABB> random_queries(rand_f32 &rng, size_t n) {
+        std::vector<AABB> queries;
+        for (size_t i=0; i<n; i++) {
+            float x = rng.get_uniform(-100.f, 1100.f), y = rng.get_uniform(-100.f, 1100.f);
+            float s = (i % 4 == 0) ? 0.f : rng.get_uniform(0.f, (i % 4 == 1) ? 10.f : 300.f);
+            queries.push_back(make_box<AABB>(x, y, s, s));
+        }
+        queries.push_back(make_box<AABB>(500.f, 500.f, 0.f, 0.f));
+        queries.push_back(make_box<AABB>(-1e7f, -1e7f, 2e7f, 2e7f));
+        return queries;
+    }
+
+    // the reference, the same predicate the trees use applied to every box, in ascending order
+    template<typename AABB>
+    std::vector<uint64_t> brute_force(std::vector<AABB> const& boxes, AABB const& q) {
+        std::vector<uint64_t> out;
+        for (uint64_t i=0; i<boxes.size(); i++) {
+            if (q.intersect(boxes[i])) out.push_back(i);
+        }
+        return out;
+    }
+
+    // what the const query of a tree over input indices returns, in ascending order
+    template<typename TREE>
+    std::vector<uint64_t> by_visitor(TREE const& tree, typename TREE::aabb_t const& q) {
+        std::vector<uint64_t> out;
+        tree.query(q, [&](uint64_t i) { out.push_back(i); });
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+};
+
+#endif